@@ -0,0 +1,229 @@
+// Micro-benchmarks for the Rack-independent core. Build and run with "make bench".
+// Results are printed as JSON, so that they can be saved and diffed between releases.
+
+#include "ChordCore.hpp"
+#include "ChordEngine.hpp"
+#include "TransitionTable.hpp"
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+static const char* chordNames[maxJumbleNotes] = {"Monad", "Diad", "Triad", "Tetrad", "Pentad", "Hexad", "Heptad",
+	"8 notes", "9 notes", "10 notes", "11 notes", "12 notes", "13 notes", "14 notes", "15 notes", "16 notes"};
+
+static volatile float sink = 0.f;	// Results are accumulated here so the compiler can't discard the work
+
+static bool firstResult = true;
+
+static void printResult(const char* name, int numNotes, float jumbleAmount, double nsPerCall, long long calls)
+{
+	printf("%s\n\t\t{\"name\": \"%s\"", firstResult ? "" : ",", name);
+	if( numNotes > 0 ) {
+		printf(", \"notes\": %d, \"chord\": \"%s\"", numNotes, chordNames[numNotes - 1]);
+	}
+	if( jumbleAmount >= 0.f ) {
+		printf(", \"jumble\": %.1f", jumbleAmount);
+	}
+	printf(", \"ns_per_call\": %.2f, \"calls\": %lld}", nsPerCall, calls);
+	firstResult = false;
+}
+
+// Calls fn(i) for i = 0, 1, 2... in ever larger batches, until a batch takes long enough to time
+// reliably, and returns the average ns per call of that batch
+template <typename Fn>
+static double timeCalls(Fn fn, long long &calls)
+{
+	typedef std::chrono::steady_clock Clock;
+	const double minBatchSeconds = 0.02;
+	for( long long batch = 1; ; batch *= 2 ) {
+		Clock::time_point start = Clock::now();
+		for( long long i = 0; i < batch; i++ ) {
+			fn(i);
+		}
+		double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+		if( seconds >= minBatchSeconds ) {
+			calls = batch;
+			return seconds * 1e9 / batch;
+		}
+	}
+}
+
+static void benchScales()
+{
+	long long calls = 0;
+	std::string modeStrings[7];
+	for( int mode = 0; mode < 7; mode++ ) {
+		modeStrings[mode] = generateModeString(mode);
+	}
+
+	// Pitches from -5V to +5V, in every key and mode
+	double ns = timeCalls([&](long long i) {
+		bool outOfKey = false;
+		sink += semiToNoteWithinKeySig((int)(i % 121) - 60, (int)(i % 12), modeStrings[i % 7], &outOfKey);
+	}, calls);
+	printResult("semiToNoteWithinKeySig", 0, -1.f, ns, calls);
+
+	const Scale &diatonic = builtInScale(DIATONIC_SCALE);
+	ns = timeCalls([&](long long i) {
+		bool outOfKey = false;
+		sink += diatonic.StepToNote((int)(i % 121) - 60, (int)(i % 7), &outOfKey);
+	}, calls);
+	printResult("Scale::StepToNote", 0, -1.f, ns, calls);
+
+	ns = timeCalls([&](long long i) {
+		sink += noteToSemiWithinKeySig((int)(i % 71) - 35, (int)(i % 12), modeStrings[i % 7]);
+	}, calls);
+	printResult("noteToSemiWithinKeySig", 0, -1.f, ns, calls);
+
+	ns = timeCalls([&](long long i) {
+		sink += diatonic.NoteToStep((int)(i % 71) - 35, (int)(i % 7));
+	}, calls);
+	printResult("Scale::NoteToStep", 0, -1.f, ns, calls);
+
+	// Quantizing is arithmetic for equal tunings, and a table lookup for others
+	ns = timeCalls([&](long long i) {
+		sink += diatonic.Quantize((int)(i % 1201) / 120.f - 5.f, (int)(i % 12), (int)(i % 7));
+	}, calls);
+	printResult("Scale::Quantize (12-EDO)", 0, -1.f, ns, calls);
+
+	std::string error;
+	std::unique_ptr<Scale> unequal = Scale::FromScala("Just intonation\n 7\n9/8\n5/4\n4/3\n3/2\n5/3\n15/8\n2/1\n", error);
+	ns = timeCalls([&](long long i) {
+		sink += unequal->Quantize((int)(i % 1201) / 120.f - 5.f, (int)(i % 12), (int)(i % 7));
+	}, calls);
+	printResult("Scale::Quantize (Scala)", 0, -1.f, ns, calls);
+}
+
+// Rollovers from the chord on note 0 of C Ionian, up and down by up to a fifth
+const int numSteps = 8;
+static const int steps[numSteps] = {1, -1, 2, -2, 3, -3, 4, -4};
+
+static void benchJumble()
+{
+	std::unique_ptr<JumbleWorkspace> workspace(new JumbleWorkspace);
+	long long calls = 0;
+
+	for( int numNotes = 1; numNotes <= maxJumbleNotes; numNotes++ ) {
+		ChordPitches fromPitches = chordPitchesForNote(0, builtInScale(DIATONIC_SCALE), 0, 0, numNotes);
+		ChordPitches toPitches[numSteps];
+		for( int s = 0; s < numSteps; s++ ) {
+			toPitches[s] = chordPitchesForNote(steps[s], builtInScale(DIATONIC_SCALE), 0, 0, numNotes);
+		}
+
+		double ns = timeCalls([&](long long i) {
+			float mean = 0.f;
+			float stdDev = 0.f;
+			meanStandardDeviation(toPitches[i % numSteps], mean, stdDev);
+			sink += stdDev;
+		}, calls);
+		printResult("meanStandardDeviation", numNotes, -1.f, ns, calls);
+
+		int order[maxJumbleNotes];
+		for( int voice = 0; voice < numNotes; voice++ ) {
+			order[voice] = numNotes - 1 - voice;
+		}
+		ns = timeCalls([&](long long i) {
+			sink += jumblednessScore(toPitches[i % numSteps], order, fromPitches).PleaseAvoid();
+		}, calls);
+		printResult("jumblednessScore", numNotes, -1.f, ns, calls);
+
+		for( int setting = 0; setting <= 10; setting++ ) {
+			float jumbleAmount = setting / 10.f;
+			ns = timeCalls([&](long long i) {
+				sink += jumbleChord(toPitches[i % numSteps], fromPitches, jumbleAmount, *workspace)[0];
+			}, calls);
+			printResult("jumbleChord", numNotes, jumbleAmount, ns, calls);
+		}
+	}
+}
+
+static void benchTransitionTable()
+{
+	std::unique_ptr<JumbleWorkspace> workspace(new JumbleWorkspace);
+	std::unique_ptr<TransitionTable> table(new TransitionTable);
+	long long calls = 0;
+
+	for( int numNotes = 1; numNotes <= maxJumbleNotes; numNotes++ ) {
+		const Scale &diatonic = builtInScale(DIATONIC_SCALE);
+		TransitionParams params = {0, 0, numNotes, 0.5f, diatonic.Id()};
+		double ns = timeCalls([&](long long i) {
+			table->Build(params, diatonic, *workspace);
+			sink += table->voiceTargets[0];
+		}, calls);
+		printResult("TransitionTable::Build", numNotes, params.jumbleAmount, ns, calls);
+	}
+}
+
+// Evaluating each glide curve directly (as the engine used to every sample), against looking it up
+// in the baked table, and against rebaking the table (as the engine does when the profile knob moves)
+static void benchGlideCurves()
+{
+	long long calls = 0;
+	GlideCurveTable table;
+
+	for( int curve = 0; curve < NUM_GLIDE_CURVES; curve++ ) {
+		double ns = timeCalls([&](long long i) {
+			sink += glideCurve(curve, (i % 1000) / 1000.f, 3.5f);
+		}, calls);
+		printResult((std::string("glideCurve ") + glideCurveName(curve)).c_str(), 0, -1.f, ns, calls);
+
+		table.Update(curve, 3.5f);
+		ns = timeCalls([&](long long i) {
+			sink += table.Lookup((i % 1000) / 1000.f);
+		}, calls);
+		printResult((std::string("GlideCurveTable::Lookup ") + glideCurveName(curve)).c_str(), 0, -1.f, ns, calls);
+
+		ns = timeCalls([&](long long i) {
+			table.Update(curve, 1.f + (i % 2));
+			sink += table.Lookup(0.5f);
+		}, calls);
+		printResult((std::string("GlideCurveTable::Update ") + glideCurveName(curve)).c_str(), 0, -1.f, ns, calls);
+	}
+}
+
+// One sample of the engine, with as many voices as there are output channels for, each rolling
+// over to a new key every 50ms and gliding for 40ms of it, with the notes of each glide strummed or not
+static void benchEngine(int strum)
+{
+	const float sampleTime = 1.f / 48000.f;
+	const int samplesPerKey = 2400;
+	long long calls = 0;
+
+	for( int numNotes = 1; numNotes <= maxChordNotes; numNotes++ ) {
+		ChordEngineSettings settings = {&builtInScale(DIATONIC_SCALE), 0, 0, numNotes, 0.04f, 2.f, 0.5f, SIGMOID_GLIDE_CURVE, strum, 0.5f};
+		int numVoices = maxChordNotes / numNotes;
+		std::unique_ptr<ChordEngine> engine(new ChordEngine(true));
+		float voct[maxEngineVoices] = {};
+		float gate[maxEngineVoices] = {};
+		// Play every voice, and have the jumbles worked out, before timing
+		engine->Process(settings, voct, gate, numVoices, sampleTime);
+		std::fill(gate, gate + maxEngineVoices, 10.f);
+		engine->Process(settings, voct, gate, numVoices, sampleTime);
+		double ns = timeCalls([&](long long i) {
+			for( int voice = 0; voice < numVoices; voice++ ) {
+				// Staggered, so that the voices roll over at different times
+				long long sample = i + voice * samplesPerKey / numVoices;
+				if( sample % samplesPerKey == 0 ) {
+					voct[voice] = steps[(sample / samplesPerKey) % numSteps] / 12.f;
+				}
+			}
+			engine->Process(settings, voct, gate, numVoices, sampleTime);
+			sink += engine->pitchOutputs[0];
+		}, calls);
+		printResult(strum == NO_STRUM ? "ChordEngine::Process" : "ChordEngine::Process strummed", numNotes, settings.jumbleAmount, ns, calls);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	printf("{\n\t\"benchmark\": \"ChordRollover core\",\n\t\"results\": [");
+	benchScales();
+	benchJumble();
+	benchTransitionTable();
+	benchGlideCurves();
+	benchEngine(NO_STRUM);
+	benchEngine(STRUM_START_UP);
+	printf("\n\t]\n}\n");
+	return 0;
+}
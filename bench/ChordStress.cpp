@@ -0,0 +1,273 @@
+// Headless stress test of many ChordRollover instances at once, run the way Rack's engine runs
+// modules: every sample, each of the engine's threads steps its share of the modules, and then they
+// all wait at a barrier for the next sample. Reports throughput, the time taken by each audio
+// block against its deadline, and the scaling from one thread to many, as JSON.
+// Build and run with "make stress", passing arguments with STRESS_ARGS.
+//
+//   ChordStress [modules] [max threads] [seconds]
+//       Runs modules instances (256 by default), each with its own random knobs and rollovers, for
+//       seconds (2 by default) of 48kHz audio on 1, 2, 4... threads, up to max threads (by default,
+//       the number of cores).
+//
+// Each instance is a ChordEngine, plus the per-sample bookkeeping of the module's process():
+// profiling counters, and a trace recorder that isn't recording. They are allocated one at a time,
+// as Rack does, and dealt out to the threads in turn, so that neighbours in memory run on different
+// threads (where false sharing would show). The heap allocations made on the engine's threads are
+// counted, and should be zero.
+// Besides the engine's threads, the process has the threads every instance shares: the jumble worker
+// that builds all of their tables, and the diagnostic logger. (Before the worker was shared, each
+// instance had a worker thread of its own, so a run of 256 modules had 256 more threads competing
+// for the cores.) The JSON has the number of threads in the process, with and without a run going.
+
+#include "AllocCounter.hpp"
+#include "ChordEngine.hpp"
+#include "TraceRecorder.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+static const float sampleRate = 48000.f;
+static const int blockSamples = 256;		// A typical audio device block
+
+typedef std::chrono::steady_clock Clock;
+
+static double secondsBetween(Clock::time_point start, Clock::time_point end)
+{
+	return std::chrono::duration<double>(end - start).count();
+}
+
+// One module, and the player playing it
+struct StressModule
+{
+	ChordEngine engine;
+	ProcessStats processStats;
+	TraceRecorder recorder;
+	float params[NUM_ENGINE_PARAMS];
+	float voct[maxEngineVoices];
+	float gate[maxEngineVoices];
+	int numVoices;
+	uint32_t random;
+
+	explicit StressModule(uint32_t seed)
+	: random(seed | 1)
+	{
+		params[KEYSIG_ENGINE_PARAM] = (float)(int)(Unit() * 12.f);
+		params[MODE_ENGINE_PARAM] = (float)(int)(Unit() * 7.f);
+		params[CHORD_ENGINE_PARAM] = (float)(1 + (int)(Unit() * (Unit() < 0.8f ? 7.f : 16.f)));
+		params[TIME_ENGINE_PARAM] = 0.01f + Unit() * 0.2f;
+		params[PROFILE_ENGINE_PARAM] = 1.f + Unit() * 9.f;
+		params[JUMBLE_ENGINE_PARAM] = Unit();
+		params[CURVE_ENGINE_PARAM] = (float)(int)(Unit() * NUM_GLIDE_CURVES);
+		params[STRUM_ENGINE_PARAM] = (float)(int)(Unit() * NUM_STRUM_MODES);
+		params[SPREAD_ENGINE_PARAM] = Unit();
+		numVoices = 1 + (int)(Unit() * 4.f);
+		std::fill(voct, voct + maxEngineVoices, 0.f);
+		std::fill(gate, gate + maxEngineVoices, 10.f);
+	}
+
+	// xorshift, as it's cheap and needs no shared state
+	float Unit()
+	{
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		return (random >> 8) * (1.f / 16777216.f);
+	}
+
+	void Process(const Scale &scale)
+	{
+		const float sampleTime = 1.f / sampleRate;
+		ProcessTimer timer(processStats, sampleTime);
+		// Each voice has a new key every 50ms or so, and lifts its gate every 250ms or so.
+		// Every second or so the jumble knob moves, so the worker builds a new table.
+		if( Unit() < 1.f / sampleRate ) {
+			params[JUMBLE_ENGINE_PARAM] = Unit();
+		}
+		for( int voice = 0; voice < numVoices; voice++ ) {
+			if( Unit() < 1.f / 2400.f ) {
+				voct[voice] = (int)(Unit() * 36.f - 12.f) / 12.f;
+			}
+			if( Unit() < 1.f / 12000.f ) {
+				gate[voice] = gate[voice] > 0.f ? 0.f : 10.f;
+			}
+		}
+		engine.Process(ChordEngineSettings::FromParams(&scale, params), voct, gate, numVoices, sampleTime);
+		if( recorder.BeginFrame() ) {
+			// Never recording
+			recorder.EndFrame();
+		}
+	}
+};
+
+// Like Rack's engine barrier: spins briefly, then yields, until every thread has arrived
+class Barrier
+{
+	private:
+		const int m_threads;
+		std::atomic<int> m_arrived;
+		std::atomic<int> m_generation;
+	public:
+		explicit Barrier(int threads) : m_threads(threads), m_arrived(0), m_generation(0) {}
+		void Wait()
+		{
+			int generation = m_generation.load(std::memory_order_acquire);
+			if( m_arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == m_threads ) {
+				m_arrived.store(0, std::memory_order_relaxed);
+				m_generation.store(generation + 1, std::memory_order_release);
+				return;
+			}
+			for( int spins = 0; m_generation.load(std::memory_order_acquire) == generation; spins++ ) {
+				if( spins > 1000 ) {
+					std::this_thread::yield();
+				}
+			}
+		}
+};
+
+// The threads in the process, or -1 where that can't be found out (only Linux says)
+static int processThreads()
+{
+	int threads = -1;
+	FILE *status = fopen("/proc/self/status", "r");
+	if( status ) {
+		char line[256];
+		while( fgets(line, sizeof(line), status) ) {
+			if( strncmp(line, "Threads:", 8) == 0 ) {
+				threads = atoi(line + 8);
+			}
+		}
+		fclose(status);
+	}
+	return threads;
+}
+
+struct StressRun
+{
+	double seconds;
+	std::vector<double> blockSeconds;		// Measured by thread 0, from the start of each block to the barrier after its last sample
+	std::vector<double> busySeconds;		// Per thread, spent processing modules rather than waiting
+	std::vector<long long> moduleSamples;	// Per thread
+	long long allocations;
+	int processThreads;						// While it ran
+};
+
+// Runs the modules for blocks blocks on threads threads (the calling thread being thread 0)
+static StressRun run(std::vector<std::unique_ptr<StressModule>> &modules, const Scale &scale, int threads, int blocks)
+{
+	StressRun result;
+	result.blockSeconds.resize(blocks);
+	result.busySeconds.resize(threads);
+	result.moduleSamples.resize(threads);
+	std::atomic<long long> allocations(0);
+	Barrier barrier(threads);
+
+	auto work = [&](int thread) {
+		long long startAllocations = threadAllocationCount();
+		double busy = 0.0;
+		long long moduleSamples = 0;
+		for( int block = 0; block < blocks; block++ ) {
+			Clock::time_point blockStart = Clock::now();
+			for( int i = 0; i < blockSamples; i++ ) {
+				Clock::time_point start = Clock::now();
+				for( size_t module = thread; module < modules.size(); module += threads ) {
+					modules[module]->Process(scale);
+					moduleSamples++;
+				}
+				busy += secondsBetween(start, Clock::now());
+				barrier.Wait();
+			}
+			if( thread == 0 ) {
+				result.blockSeconds[block] = secondsBetween(blockStart, Clock::now());
+			}
+		}
+		result.busySeconds[thread] = busy;
+		result.moduleSamples[thread] = moduleSamples;
+		allocations += threadAllocationCount() - startAllocations;
+	};
+
+	// The threads' vectors were sized above, so nothing allocates while they run
+	Clock::time_point start = Clock::now();
+	std::vector<std::thread> workers;
+	for( int thread = 1; thread < threads; thread++ ) {
+		workers.push_back(std::thread(work, thread));
+	}
+	result.processThreads = processThreads();
+	work(0);
+	for( std::thread &worker : workers ) {
+		worker.join();
+	}
+	result.seconds = secondsBetween(start, Clock::now());
+	result.allocations = allocations.load();
+	return result;
+}
+
+static double percentile(const std::vector<double> &sorted, double fraction)
+{
+	return sorted[std::min(sorted.size() - 1, (size_t)(fraction * sorted.size()))];
+}
+
+int main(int argc, char** argv)
+{
+	int numModules = argc > 1 ? atoi(argv[1]) : 256;
+	int maxThreads = argc > 2 ? atoi(argv[2]) : (int)std::max(1u, std::thread::hardware_concurrency());
+	double audioSeconds = argc > 3 ? atof(argv[3]) : 2.0;
+	if( numModules < 1 || maxThreads < 1 || audioSeconds <= 0.0 ) {
+		fprintf(stderr, "Usage: ChordStress [modules] [max threads] [seconds]\n");
+		return 1;
+	}
+	int blocks = std::max(1, (int)(audioSeconds * sampleRate / blockSamples));
+	const Scale &scale = builtInScale(DIATONIC_SCALE);
+
+	std::vector<std::unique_ptr<StressModule>> modules;
+	for( int module = 0; module < numModules; module++ ) {
+		modules.push_back(std::unique_ptr<StressModule>(new StressModule(0x9E3779B9u * (module + 1))));
+	}
+
+	// A quarter of a second to play the first chords and build the first jumble tables
+	run(modules, scale, maxThreads, std::max(1, (int)(0.25 * sampleRate / blockSamples)));
+
+	std::vector<int> threadCounts;
+	for( int threads = 1; threads < maxThreads; threads *= 2 ) {
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(maxThreads);
+
+	const double deadline = blockSamples / sampleRate;
+	double singleThreadThroughput = 0.0;
+	printf("{\n\t\"benchmark\": \"ChordRollover multi-instance stress\",\n\t\"modules\": %d,\n\t\"block_samples\": %d,\n\t\"deadline_us\": %.1f,\n\t\"idle_process_threads\": %d,\n\t\"runs\": [",
+		numModules, blockSamples, deadline * 1e6, processThreads());
+	for( size_t index = 0; index < threadCounts.size(); index++ ) {
+		int threads = threadCounts[index];
+		StressRun result = run(modules, scale, threads, blocks);
+		long long moduleSamples = 0;
+		for( long long count : result.moduleSamples ) {
+			moduleSamples += count;
+		}
+		double throughput = moduleSamples / result.seconds;
+		if( threads == 1 ) {
+			singleThreadThroughput = throughput;
+		}
+		std::vector<double> sorted = result.blockSeconds;
+		std::sort(sorted.begin(), sorted.end());
+		long long overruns = std::count_if(sorted.begin(), sorted.end(), [=](double seconds) {return seconds > deadline;});
+
+		printf("%s\n\t\t{\"threads\": %d, \"process_threads\": %d, \"module_samples_per_second\": %.0f, \"realtime_factor\": %.2f, \"scaling\": %.2f,",
+			index == 0 ? "" : ",", threads, result.processThreads, throughput, blocks * deadline / result.seconds, throughput / (singleThreadThroughput * threads));
+		printf("\n\t\t\t\"block_us\": {\"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}, \"overruns\": %lld, \"allocations\": %lld,",
+			percentile(sorted, 0.5) * 1e6, percentile(sorted, 0.99) * 1e6, percentile(sorted, 0.999) * 1e6, sorted.back() * 1e6, overruns, result.allocations);
+		printf("\n\t\t\t\"per_thread_module_samples_per_busy_second\": [");
+		for( int thread = 0; thread < threads; thread++ ) {
+			printf("%s%.0f", thread == 0 ? "" : ", ", result.moduleSamples[thread] / std::max(result.busySeconds[thread], 1e-9));
+		}
+		printf("]}");
+		fflush(stdout);
+	}
+	printf("\n\t]\n}\n");
+	return 0;
+}
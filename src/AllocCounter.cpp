@@ -0,0 +1,41 @@
+#include "AllocCounter.hpp"
+
+#ifdef CHORDROLLOVER_ALLOC_COUNTER
+#include <cstdlib>
+#include <new>
+
+// Replacements for the global allocation functions that count calls per thread.
+// (Memory still comes from malloc, so blocks can be freed by either implementation.)
+
+static thread_local long long allocationCount = 0;
+
+long long threadAllocationCount()
+{
+	return allocationCount;
+}
+
+void* operator new(std::size_t size)
+{
+	allocationCount++;
+	void* p = std::malloc(size ? size : 1);
+	if( !p ) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+#endif
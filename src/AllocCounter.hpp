@@ -0,0 +1,35 @@
+#pragma once
+
+// A debug-only count of the heap allocations made by the current thread.
+// Build with "make ALLOC_COUNTER=1" to enable it. Otherwise it compiles away and
+// AssertNoAllocations does nothing.
+
+#ifdef CHORDROLLOVER_ALLOC_COUNTER
+#include <cassert>
+
+// Number of times operator new has been called on this thread so far
+long long threadAllocationCount();
+
+// Asserts when it goes out of scope that there were no allocations on this thread while it existed
+class AssertNoAllocations
+{
+	private:
+		long long m_startCount;
+	public:
+		AssertNoAllocations() : m_startCount(threadAllocationCount()) {}
+		~AssertNoAllocations()
+		{
+			assert(threadAllocationCount() == m_startCount);
+		}
+		long long AllocationsSoFar() const {return threadAllocationCount() - m_startCount;}
+};
+#else
+inline long long threadAllocationCount() {return 0;}
+
+class AssertNoAllocations
+{
+	public:
+		AssertNoAllocations() {}
+		long long AllocationsSoFar() const {return 0;}
+};
+#endif
@@ -0,0 +1,366 @@
+#include "ChordCore.hpp"
+#include <cfloat>
+
+static void discardLog(const char* message)
+{
+}
+
+void (*chordCoreLog)(const char* message) = discardLog;
+
+const char* whiteNoteIntervals = "TTSTTTS";
+
+std::string generateModeString(int mode)
+{
+	assert( mode >= 0 );
+	assert( mode < 7 );
+
+	std::string result = "0123456\0";
+	for( int i=0; i<7; i++ ) {
+		result[i] = whiteNoteIntervals[(i+ mode) % 7];
+	}
+	result[7] = '\0';
+	return result;
+}
+
+int semiToNoteWithinKeySig(int semi, int key, std::string modeString, bool *outOfKey)
+{
+	assert(key >= 0);
+	assert(key <= 11);
+	assert(modeString[7] == '\0');
+
+	int semiToTry = key;
+	*outOfKey = false;
+	int semiModulo12 = niceModulo(semi, 12);
+ 	for( int noteToTry = 0; noteToTry <= 6; noteToTry++ ) {
+		if( semiModulo12 == niceModulo(semiToTry, 12) ) {
+			// Found a matching note, now find the octave
+			for( int octave = -10; octave < 10; octave++ ) {
+				if( semi == semiToTry + octave * 12 ) {
+					return noteToTry + octave * 7;
+				}
+			}
+		}
+		if( modeString[noteToTry] == 'T' ) {
+			semiToTry += 2;
+		} else {
+			semiToTry += 1;
+		}
+	}
+	// No exact match. Find the match that works when we start a semi lower...
+	*outOfKey = true;
+	semiToTry = key;
+	semi -= 1;
+	semiModulo12 = niceModulo(semi, 12);
+	for( int noteToTry = 0; noteToTry <= 6; noteToTry++ ) {
+		if( semiModulo12 == niceModulo(semiToTry, 12) ) {
+			// Found a matching note, now find the octave
+			for( int octave = -10; octave < 10; octave++ ) {
+				if( semi == semiToTry + octave * 12 ) {
+					return noteToTry + octave * 7;
+				}
+			}
+		}
+		if( modeString[noteToTry] == 'T' ) {
+			semiToTry += 2;
+		} else {
+			semiToTry += 1;
+		}
+	}
+	// That didn't match either. Impossible!
+	assert(false);
+	return 0;
+}
+
+int noteToSemiWithinKeySig(int note, int key, std::string modeString)
+{
+	int semi = key;
+	// First shift by whole octaves
+	while( note < 0 ) {
+		semi -= 12;
+		note += 7;
+	}
+	for( int stepNote = 1; stepNote <= note; stepNote++ ) {
+		int modeIndex = (stepNote -1) % 7 ;
+		if( modeString[modeIndex] == 'T' ) {
+			semi += 2;
+		} else {
+			semi += 1;
+		}
+	}
+	return semi;
+}
+
+void meanStandardDeviation(const ChordPitches& data, float &mean, float &stdDev)
+{
+	float sum = 0.f;
+	float sum_of_squares = 0.f;
+	int n = data.size();
+
+	for( int i = 0; i < n; i++ ) {
+		sum += data[i];
+		sum_of_squares += (data[i] * data[i]);
+	}
+
+	mean = sum / n;
+	// A single value has no spread (rather than the NaN that dividing by n - 1 would give)
+	float variance = n > 1 ? (sum_of_squares - (sum * sum / n)) / (n - 1) : 0.f;
+	// Rounding can take the variance of (near) identical values just below zero
+	stdDev = sqrt(std::max(variance, 0.f));
+}
+
+// jumblednessScore() on plain arrays. Inlined into the callers that know n at compile time, so
+// that their loops are unrolled.
+static inline JumbleScore scoreOrder(const float *toChordPitches, const int *order, const float *fromChordPitches, int n)
+{
+	float sum = 0.f;
+	float sum_of_squares = 0.f;
+	float minAbsChange = FLT_MAX;
+	uint64_t packedOrder = 0;
+	for( int i = 0; i < n; i++ ) {
+		float pitchChange = toChordPitches[order[i]] - fromChordPitches[i];
+		sum += pitchChange;
+		sum_of_squares += (pitchChange * pitchChange);
+		minAbsChange = std::min(minAbsChange, std::abs(pitchChange));
+		packedOrder = (packedOrder << 4) | (uint64_t)order[i];
+	}
+	// As meanStandardDeviation(). Parallel motion has a variance of zero, which rounding can take just
+	// below zero, and a NaN score would break the ordering of the scores. So would a monad's n - 1 of zero.
+	float variance = n > 1 ? (sum_of_squares - (sum * sum / n)) / (n - 1) : 0.f;
+	float stdDevPitchChange = sqrt(std::max(variance, 0.f));
+
+	bool anyNotesSame = (minAbsChange < 1.f / 12.f / 5.f);	// Difference less than 5th of a semitone
+
+	return JumbleScore(packedOrder, stdDevPitchChange, minAbsChange, anyNotesSame);
+}
+
+JumbleScore jumblednessScore(const ChordPitches& toChordPitches, const int* order, const ChordPitches& fromChordPitches)
+{
+	return scoreOrder(toChordPitches.begin(), order, fromChordPitches.begin(), fromChordPitches.size());
+}
+
+// Calls gatherScore() for every distinct permutation of the N indices into sortedToPitches,
+// starting from order (which must be 0, 1, 2...). The chord size is a template parameter so that
+// each size gets its own fully unrolled scoring and permuting, with no bounds to check at runtime.
+// We permute the indices in place, comparing by pitch so that (just like permuting the pitches
+// themselves) equal pitches don't produce duplicate permutations.
+template <int N, typename GatherScore>
+static void scoreEveryPermutation(const ChordPitches &sortedToPitches, const ChordPitches &fromChordPitches, int *order, GatherScore &gatherScore)
+{
+	const float *to = sortedToPitches.begin();
+	const float *from = fromChordPitches.begin();
+	auto pitchLess = [to](int a, int b) {return to[a] < to[b];};
+	do {
+		gatherScore(scoreOrder(to, order, from, N));
+	} while (std::next_permutation(order, order + N, pitchLess));
+}
+
+void minCostAssignment(const float cost[maxJumbleNotes][maxJumbleNotes], int n, int *order)
+{
+	// Rows are voices and columns are targets, both counted from 1 here so that 0 can be the
+	// "unassigned" column. u and v are the row and column potentials.
+	double u[maxJumbleNotes + 1] = {};
+	double v[maxJumbleNotes + 1] = {};
+	int rowOfColumn[maxJumbleNotes + 1] = {};
+	int way[maxJumbleNotes + 1] = {};
+	for( int row = 1; row <= n; row++ ) {
+		// Add each row in turn, growing an alternating path from it until it reaches a free column
+		rowOfColumn[0] = row;
+		int column = 0;
+		double minSlack[maxJumbleNotes + 1];
+		bool used[maxJumbleNotes + 1];
+		std::fill(minSlack, minSlack + n + 1, DBL_MAX);
+		std::fill(used, used + n + 1, false);
+		do {
+			used[column] = true;
+			int usedRow = rowOfColumn[column];
+			double delta = DBL_MAX;
+			int nextColumn = 0;
+			for( int j = 1; j <= n; j++ ) {
+				if( !used[j] ) {
+					double slack = cost[usedRow - 1][j - 1] - u[usedRow] - v[j];
+					if( slack < minSlack[j] ) {
+						minSlack[j] = slack;
+						way[j] = column;
+					}
+					if( minSlack[j] < delta ) {
+						delta = minSlack[j];
+						nextColumn = j;
+					}
+				}
+			}
+			for( int j = 0; j <= n; j++ ) {
+				if( used[j] ) {
+					u[rowOfColumn[j]] += delta;
+					v[j] -= delta;
+				} else {
+					minSlack[j] -= delta;
+				}
+			}
+			column = nextColumn;
+		} while( rowOfColumn[column] != 0 );
+		// Flip the path
+		do {
+			int previousColumn = way[column];
+			rowOfColumn[column] = rowOfColumn[previousColumn];
+			column = previousColumn;
+		} while( column != 0 );
+	}
+	for( int j = 1; j <= n; j++ ) {
+		order[rowOfColumn[j] - 1] = j - 1;
+	}
+}
+
+// The least jumbled mapping of a chord too big to try every permutation of. It is the one with the
+// smallest sum of squared pitch changes, keeping clear of voices that don't change if possible.
+static void leastJumbledOrder(const ChordPitches &sortedToPitches, const ChordPitches &fromChordPitches, int *order)
+{
+	const float pleaseAvoidCost = 1e6f;		// Far more than any sum of squared pitch changes
+	int n = sortedToPitches.size();
+	float cost[maxJumbleNotes][maxJumbleNotes];
+	bool anyAvoidable = false;
+	for( int voice = 0; voice < n; voice++ ) {
+		for( int target = 0; target < n; target++ ) {
+			float pitchChange = sortedToPitches[target] - fromChordPitches[voice];
+			bool pleaseAvoid = std::abs(pitchChange) < 1.f / 12.f / 5.f;	// As jumblednessScore()
+			cost[voice][target] = pitchChange * pitchChange + (pleaseAvoid ? pleaseAvoidCost : 0.f);
+			anyAvoidable = anyAvoidable || pleaseAvoid;
+		}
+	}
+	minCostAssignment(cost, n, order);
+	if( anyAvoidable && jumblednessScore(sortedToPitches, order, fromChordPitches).PleaseAvoid() ) {
+		// Every mapping leaves a note where it is. Not ideal, but go for the least jumbled of them
+		for( int voice = 0; voice < n; voice++ ) {
+			for( int target = 0; target < n; target++ ) {
+				float pitchChange = sortedToPitches[target] - fromChordPitches[voice];
+				cost[voice][target] = pitchChange * pitchChange;
+			}
+		}
+		minCostAssignment(cost, n, order);
+	}
+}
+
+bool jumbleOrder(const ChordPitches &sortedToPitches, const ChordPitches &fromChordPitches, float jumbleAmount, JumbleWorkspace &workspace, int *order)
+{
+	assert(sortedToPitches.size() == fromChordPitches.size());
+	assert(sortedToPitches.size() <= maxJumbleNotes);
+	assert(std::is_sorted(sortedToPitches.begin(), sortedToPitches.end()));
+	int n = sortedToPitches.size();
+
+	// Start from the lexicographically smallest permutation
+	for( int i = 0; i < n; i++ ) {
+		order[i] = i;
+	}
+
+	// Firstly, if jumbleAmount is 0.0, and fromChordPitches is sorted, simply sort toChordPitches
+	if( jumbleAmount==0.f )
+	{
+		if( std::is_sorted(fromChordPitches.begin(), fromChordPitches.end()) ) {
+			return true;
+		}
+		if( n > maxExhaustiveJumbleNotes ) {
+			leastJumbledOrder(sortedToPitches, fromChordPitches, order);
+			return false;
+		}
+	}
+
+	// We gather a score for every permutation, each as either "allowed" or "avoidable"
+	JumbleScore *scores = workspace.scores;
+	int allowedCount = 0;
+	int avoidableCount = 0;
+	auto gatherScore = [&](const JumbleScore &score) {
+		if( score.PleaseAvoid() ) {
+			avoidableCount++;
+			scores[maxJumblePermutations - avoidableCount] = score;
+		} else {
+			scores[allowedCount] = score;
+			allowedCount++;
+		}
+	};
+
+	if( n <= maxExhaustiveJumbleNotes ) {
+		static_assert(maxExhaustiveJumbleNotes == 7, "Every chord size that tries every permutation needs a case");
+		switch( n ) {
+			case 1: scoreEveryPermutation<1>(sortedToPitches, fromChordPitches, order, gatherScore); break;
+			case 2: scoreEveryPermutation<2>(sortedToPitches, fromChordPitches, order, gatherScore); break;
+			case 3: scoreEveryPermutation<3>(sortedToPitches, fromChordPitches, order, gatherScore); break;
+			case 4: scoreEveryPermutation<4>(sortedToPitches, fromChordPitches, order, gatherScore); break;
+			case 5: scoreEveryPermutation<5>(sortedToPitches, fromChordPitches, order, gatherScore); break;
+			case 6: scoreEveryPermutation<6>(sortedToPitches, fromChordPitches, order, gatherScore); break;
+			case 7: scoreEveryPermutation<7>(sortedToPitches, fromChordPitches, order, gatherScore); break;
+		}
+	} else {
+		// Too many permutations to try them all, so rank a sample of them instead. The sample always
+		// includes the least jumbled mapping and the most jumbled (each voice going to the opposite
+		// end of the chord), so that the ends of the jumble knob behave as for smaller chords.
+		// The random numbers start from the same seed each time, so that the results are repeatable.
+		int leastJumbled[maxJumbleNotes];
+		leastJumbledOrder(sortedToPitches, fromChordPitches, leastJumbled);
+		gatherScore(jumblednessScore(sortedToPitches, leastJumbled, fromChordPitches));
+		int fromRank[maxJumbleNotes];
+		for( int i = 0; i < n; i++ ) {
+			fromRank[i] = i;
+		}
+		std::sort(fromRank, fromRank + n, [&fromChordPitches](int a, int b) {return fromChordPitches[a] < fromChordPitches[b];});
+		int mostJumbled[maxJumbleNotes];
+		for( int i = 0; i < n; i++ ) {
+			mostJumbled[fromRank[i]] = n - 1 - i;
+		}
+		gatherScore(jumblednessScore(sortedToPitches, mostJumbled, fromChordPitches));
+		uint32_t random = 2463534242u;
+		for( int sample = 2; sample < jumbleSamples; sample++ ) {
+			for( int i = n - 1; i > 0; i-- ) {
+				// xorshift32, then a Fisher-Yates shuffle step
+				random ^= random << 13;
+				random ^= random >> 17;
+				random ^= random << 5;
+				std::swap(order[i], order[random % (i + 1)]);
+			}
+			gatherScore(jumblednessScore(sortedToPitches, order, fromChordPitches));
+		}
+	}
+
+	JumbleScore *candidates = scores;
+	int numCandidates = allowedCount;
+	if( allowedCount == 0 ) {
+		// Not ideal, but resort to PleaseAvoid permutations
+		candidates = scores + maxJumblePermutations - avoidableCount;
+		numCandidates = avoidableCount;
+	}
+	// Choose somewhere between first and last based on jumbleAmount.
+	// Only the chosen rank needs to be in its sorted place, not the whole list.
+	int index = (int) (jumbleAmount * (numCandidates - 1));
+	std::nth_element(candidates, candidates + index, candidates + numCandidates);
+	const JumbleScore &chosen = candidates[index];
+
+	for( int i = 0; i < n; i++ ) {
+		order[i] = chosen.VoiceTarget(i, n);
+	}
+	return false;
+}
+
+ChordPitches jumbleChord(const ChordPitches &toChordPitches, const ChordPitches &fromChordPitches, float jumbleAmount, JumbleWorkspace &workspace)
+{
+	ChordPitches sortedToPitches = toChordPitches;
+	std::sort(sortedToPitches.begin(), sortedToPitches.end());
+
+	int order[maxJumbleNotes];
+	jumbleOrder(sortedToPitches, fromChordPitches, jumbleAmount, workspace, order);
+
+	ChordPitches result;
+	for( int i = 0; i < sortedToPitches.size(); i++ ) {
+		result.push_back(sortedToPitches[order[i]]);
+	}
+	return result;
+}
+
+ChordPitches chordPitchesForNote(int validNote, const Scale &scale, int key, int mode, int numNotes)
+{
+	ChordPitches pitches;
+	for( int noteIndex = 0; noteIndex < numNotes; noteIndex++ ) {
+		// This integer is "nth note within key signature" from pressed root
+		int thisNote = validNote + scale.ChordDegree(validNote, mode, noteIndex);
+		// Convert to steps of the tuning, and then to one volt per octave
+		pitches.push_back(scale.StepToVoltage(scale.NoteToStep(thisNote, mode), key, mode));
+	}
+	return pitches;
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+// The music theory and voice jumbling at the heart of ChordRollover. Nothing in here depends on
+// Rack, so it is also built into the standalone tools (see "make bench").
+
+#include "Scale.hpp"
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <string>
+
+std::string generateModeString(int mode);
+
+inline int voltageToNearestSemi(float voltage)
+{
+	return (int)(std::round(voltage * 12.f));
+}
+
+// The reference implementation of the diatonic scale's tables (see Scale), and what they are tested against.
+// semi can be negative
+// returns a note that also incorporates the octave
+int semiToNoteWithinKeySig(int semi, int key, std::string modeString, bool *outOfKey);
+
+int noteToSemiWithinKeySig(int note, int key, std::string modeString);
+
+// A vector with a fixed capacity that lives inline (never on the heap), so that it is safe
+// to create, copy and return on the audio thread.
+template <typename T, int Capacity>
+class InlineVector
+{
+	private:
+		T m_data[Capacity];
+		int m_size;
+	public:
+		InlineVector() : m_size(0) {}
+		int size() const {return m_size;}
+		static int capacity() {return Capacity;}
+		void clear() {m_size = 0;}
+		void push_back(const T& value)
+		{
+			assert(m_size < Capacity);
+			m_data[m_size++] = value;
+		}
+		T& operator[](int i) {return m_data[i];}
+		const T& operator[](int i) const {return m_data[i];}
+		T* begin() {return m_data;}
+		T* end() {return m_data + m_size;}
+		const T* begin() const {return m_data;}
+		const T* end() const {return m_data + m_size;}
+		bool operator==(const InlineVector& other) const
+		{
+			return m_size == other.m_size && std::equal(begin(), end(), other.begin());
+		}
+		bool operator!=(const InlineVector& other) const {return !(*this == other);}
+};
+
+const int maxChordNotes = 16;		// Rack's polyphonic channel limit
+typedef InlineVector<float, maxChordNotes> ChordPitches;
+
+void meanStandardDeviation(const ChordPitches& data, float &mean, float &stdDev);
+
+const int maxJumbleNotes = maxChordNotes;
+const int maxExhaustiveJumbleNotes = 7;		// Chords up to a heptad try every permutation
+const int maxJumblePermutations = 5040;		// 7!
+const int jumbleSamples = 1024;				// The number of permutations ranked for bigger chords
+
+// A primary and secondary score for comparing "jumbledness" of chord mappings.
+// The mapping itself is packed in alongside, four bits per voice with the first voice most
+// significant, so that the winner can be read back without replaying the permutations.
+// Comparing packed orders is the same as comparing the permutations lexicographically, which
+// gives scores that tie a deterministic order.
+class JumbleScore
+{
+	private:
+		uint64_t m_order;
+		bool m_pleaseAvoid;		// True if this jumbling is to be avoided due to a note not changing
+		float m_primaryScore;
+		float m_secondaryScore;
+	public:
+		JumbleScore()
+		: m_order(0)
+		, m_pleaseAvoid(false)
+		, m_primaryScore(0.f)
+		, m_secondaryScore(0.f)
+		{
+		}
+		JumbleScore(uint64_t order, float primaryScore, float secondaryScore, bool pleaseAvoid)
+		: m_order(order)
+		, m_pleaseAvoid(pleaseAvoid)
+		, m_primaryScore(primaryScore)
+		, m_secondaryScore(secondaryScore)
+		{
+		}
+		bool PleaseAvoid() const {return m_pleaseAvoid;}
+		// Index into the "to" chord that voice goes to, for a chord of numVoices
+		int VoiceTarget(int voice, int numVoices) const {return (int)((m_order >> (4 * (numVoices - 1 - voice))) & 0xF);}
+		bool operator<(const JumbleScore &other) const
+		{
+			if(m_primaryScore < other.m_primaryScore) {return true;}
+			if(m_primaryScore > other.m_primaryScore) {return false;}
+			if(m_secondaryScore < other.m_secondaryScore) {return true;}
+			if(m_secondaryScore > other.m_secondaryScore) {return false;}
+			return m_order < other.m_order;
+		}
+};
+static_assert(maxJumbleNotes * 4 <= 64, "JumbleScore packs four bits per voice into 64 bits");
+static_assert(jumbleSamples <= maxJumblePermutations, "The sampled permutations must fit in a JumbleWorkspace");
+
+// Scores moving voice i from fromChordPitches[i] to toChordPitches[order[i]].
+// Biggest score is most jumbled. The primary score is the standard deviation of the pitch changes
+// and the secondary score is the smallest pitch change. PleaseAvoid() is important - it is true to
+// indicate that the mapping contains a note that does not change. Reserve those for emergencies
+// when there are no other mappings!
+// Works in one pass with running sums, so that it is cheap to call for every permutation.
+JumbleScore jumblednessScore(const ChordPitches& toChordPitches, const int* order, const ChordPitches& fromChordPitches);
+
+// Preallocated storage for jumbleChord(), so that it never needs the heap
+struct JumbleWorkspace
+{
+	// "Allowed" scores are gathered from the front, "avoidable" scores from the back
+	JumbleScore scores[maxJumblePermutations];
+};
+
+// Finds the assignment of voices to targets with the smallest total cost, where cost[voice][target]
+// is the cost of that voice going to that target. Fills order[voice] with the voice's target.
+// The Hungarian algorithm, so O(n^3) and without allocating.
+void minCostAssignment(const float cost[maxJumbleNotes][maxJumbleNotes], int n, int *order);
+
+// Chooses where each voice of fromChordPitches goes in sortedToPitches (which must be sorted),
+// filling order[voice] with an index into sortedToPitches.
+// Up to maxExhaustiveJumbleNotes, every permutation is scored and ranked. Bigger chords use the
+// min-cost assignment at jumbleAmount 0.0 (which is the exact answer, as the mean pitch change is
+// the same for every mapping, so the smallest spread is the smallest sum of squared changes),
+// and otherwise rank a bounded, deterministic sample of permutations.
+// Returns true if the search was bypassed, as jumbleAmount is 0.0 and fromChordPitches is sorted.
+bool jumbleOrder(const ChordPitches &sortedToPitches, const ChordPitches &fromChordPitches, float jumbleAmount, JumbleWorkspace &workspace, int *order);
+
+ChordPitches jumbleChord(const ChordPitches &toChordPitches, const ChordPitches &fromChordPitches, float jumbleAmount, JumbleWorkspace &workspace);
+
+// The pitches of the chord built on validNote, lowest first (see Scale::ChordDegree())
+ChordPitches chordPitchesForNote(int validNote, const Scale &scale, int key, int mode, int numNotes);
+
+// Where the core sends its log messages. The plugin points this at Rack's logger; by default they are dropped.
+// Only called from the diagnostic log's thread (see DiagnosticLog.hpp), never the audio thread.
+extern void (*chordCoreLog)(const char* message);
@@ -0,0 +1,428 @@
+#include "ChordEngine.hpp"
+#include <climits>
+
+const char *strumModeName(int strum)
+{
+	static const char *names[NUM_STRUM_MODES] = {"Off", "Staggered start, low notes first", "Staggered start, high notes first",
+		"Staggered arrival, low notes first", "Staggered arrival, high notes first"};
+	assert(strum >= 0 && strum < NUM_STRUM_MODES);
+	return names[strum];
+}
+
+ChordEngine::ChordEngine(bool synchronousTables)
+: m_transitionTables(synchronousTables)
+{
+	outputChannels = 1;
+	pitchOutputsChanged = false;
+	gateOutputsChanged = false;
+	rolloverBrightness = 0.f;
+	std::fill(pitchOutputs, pitchOutputs + maxChordNotes, 0.f);
+	std::fill(gateOutputs, gateOutputs + maxChordNotes, 0.f);
+	m_numVoices = 0;
+	m_sampleTime = 0.f;
+	m_glideSeconds = 0.f;
+	m_processChords = NULL;		// Set by the first Process(), as the number of notes has "changed" since Invalidate()
+	for( int block = 0; block < maxEngineBlocks; block++ ) {
+		m_triggerState[block] = float_4::mask();	// Like Rack's triggers, start high so that a gate already high doesn't trigger
+	}
+	std::fill(m_prevPitch, m_prevPitch + maxEngineVoices, 0.f);
+	std::fill(m_timerSamples, m_timerSamples + maxEngineVoices, 0.f);
+	std::fill(m_glideIncrement, m_glideIncrement + maxEngineVoices, 0.f);
+	std::fill(m_glideScale, m_glideScale + maxEngineVoices, 1.f);
+	std::fill(m_lastValidNote, m_lastValidNote + maxEngineVoices, 0);
+	std::fill(m_gateSuppressed, m_gateSuppressed + maxEngineVoices, false);
+	std::fill(m_fromNote, m_fromNote + maxEngineVoices, 0);
+	std::fill(m_toNote, m_toNote + maxEngineVoices, 0);
+	std::fill(m_brightness, m_brightness + maxEngineVoices, 0.f);
+	std::fill(m_strummed, m_strummed + maxEngineVoices, false);
+	std::fill(m_prevGateOutput, m_prevGateOutput + maxEngineVoices, -1.f);
+	std::fill(m_fromPitches, m_fromPitches + maxChordNotes, 0.f);
+	std::fill(m_toPitches, m_toPitches + maxChordNotes, 0.f);
+	std::fill(m_voiceTargets, m_voiceTargets + maxChordNotes, 0);
+	std::fill(m_glideSamples, m_glideSamples + maxChordNotes, 0.f);
+	std::fill(m_glideRate, m_glideRate + maxChordNotes, 0.f);
+	std::fill(m_pressedNote, m_pressedNote + maxEngineVoices, 0);
+	std::fill(m_pressedOutOfKey, m_pressedOutOfKey + maxEngineVoices, false);
+	std::fill(m_chordNote, m_chordNote + maxEngineVoices, 0);
+	Invalidate();
+}
+
+void ChordEngine::Invalidate()
+{
+	m_prevNumNotes = -1;
+	m_cacheScale = NULL;
+	m_cacheKey = -1;
+	m_cacheMode = -1;
+	m_cacheNumNotes = -1;
+	std::fill(m_pressedStep, m_pressedStep + maxEngineVoices, INT_MIN);
+	std::fill(m_chordValid, m_chordValid + maxEngineVoices, false);
+}
+
+int ChordEngine::notePressed(int voice, float voct, const ChordEngineSettings &settings, bool &invalidPress)
+{
+	int step = settings.scale->Quantize(voct, settings.key, settings.mode);
+	if( step != m_pressedStep[voice] ) {
+		m_pressedNote[voice] = settings.scale->StepToNote(step, settings.mode, &m_pressedOutOfKey[voice]);
+		m_pressedStep[voice] = step;
+	}
+	invalidPress = m_pressedOutOfKey[voice];
+	return m_pressedNote[voice];
+}
+
+// The chord for the voice's last valid note, only rebuilt when the note, key sig, mode or number of notes has changed
+const ChordPitches &ChordEngine::currentChord(int voice, const ChordEngineSettings &settings)
+{
+	int validNote = m_lastValidNote[voice];
+	if( !m_chordValid[voice] || validNote != m_chordNote[voice] ) {
+		m_chords[voice] = chordPitchesForNote(validNote, *settings.scale, settings.key, settings.mode, settings.numNotes);
+		m_chordNote[voice] = validNote;
+		m_chordValid[voice] = true;
+	}
+	return m_chords[voice];
+}
+
+// User has "rolled over" from one key to another, initiating a portamento glide
+template <int NumNotes>
+void ChordEngine::startGlide(int voice, const ChordEngineSettings &settings, const TransitionParams &transitionParams, float sampleTime)
+{
+	const int numNotes = NumNotes;
+	float *fromPitches = m_fromPitches + voice * numNotes;
+	float *toPitches = m_toPitches + voice * numNotes;
+
+	// Where do we want to get to?
+	const ChordPitches &chord = currentChord(voice, settings);
+
+	// Where are we now?
+	bool abortedPreviousGlide = false;
+	int glideFromNote = m_fromNote[voice];
+	if( m_glideIncrement[voice] > 0.f ) {
+		// We WERE in the middle of a slide already.
+		// Start the new slide from wherever we'd got to so far.
+		for( int i=0; i<numNotes; i++ ) {
+			float progress = std::min(std::max(m_glideSamples[voice * numNotes + i] * m_glideRate[voice * numNotes + i], 0.f), 1.f);
+			float modifiedProgress = m_glideCurve.Lookup(progress);
+			fromPitches[i] = modifiedProgress * toPitches[i] + (1.f - modifiedProgress) * fromPitches[i];
+		}
+		std::sort(fromPitches, fromPitches + numNotes);	// Seems sensible in the face of a slight bug
+		abortedPreviousGlide = true;
+		stats.glideAborts.Add(1);
+		// For the jumble, treat it as a rollover from the chord we were heading for
+		glideFromNote = m_toNote[voice];
+	} else {
+		// We're sliding from a previously steady chord
+		// fromPitches is already set
+	}
+
+	// Jumble notes in chord according to: jumble amount, where we are now, and where we want to get to.
+	// The jumble was worked out in advance by the worker thread. A table for an earlier jumble amount
+	// does until it catches up with the knobs. Until it has a table for the key sig, mode, chord size
+	// and scale, or for a rollover further than the table reaches, voices go to the sorted chord (as for no jumble).
+	const TransitionTable *table = m_transitionTables.Latest(transitionParams);
+	const uint8_t *voiceTargets = table ? table->Lookup(glideFromNote, m_lastValidNote[voice]) : NULL;
+	if( !table ) {
+		m_diagnostics.Post(TABLE_NOT_READY_EVENT, (float)numNotes, settings.jumbleAmount);
+	} else if( !voiceTargets ) {
+		m_diagnostics.Post(ROLLOVER_OUT_OF_REACH_EVENT, (float)glideFromNote, (float)m_lastValidNote[voice]);
+	}
+	for( int i=0; i<numNotes; i++ ) {
+		m_voiceTargets[voice * numNotes + i] = voiceTargets ? voiceTargets[i] : i;
+		toPitches[i] = chord[m_voiceTargets[voice * numNotes + i]];
+	}
+	m_toNote[voice] = m_lastValidNote[voice];
+
+	// If we started this glide from within a previous glide, we spend half as long on the new glide.
+	// The increment follows the glide time knob and the sample rate from here on (see retimeGlides()).
+	m_glideScale[voice] = abortedPreviousGlide ? 0.5f : 1.f;
+	float glideSamples = std::max(m_glideScale[voice] * settings.glideSeconds / sampleTime, 1.f);
+	m_glideIncrement[voice] = 1.f / glideSamples;
+	m_timerSamples[voice] = 0.f;	// Start of glide
+
+	// Share the glide out between the notes. Unstrummed, each note takes all of it. A strum staggers
+	// either their starts or their arrivals over strumSpread of it, so that the last note still
+	// arrives at the end.
+	float stagger = (settings.strum == NO_STRUM) ? 0.f : settings.strumSpread * glideSamples;
+	bool downwards = (settings.strum == STRUM_START_DOWN || settings.strum == STRUM_ARRIVE_DOWN);
+	bool staggeredStart = (settings.strum == STRUM_START_UP || settings.strum == STRUM_START_DOWN);
+	for( int i=0; i<numNotes; i++ ) {
+		int rank = downwards ? numNotes - 1 - i : i;
+		float offset = (numNotes > 1) ? stagger * rank / (numNotes - 1) : 0.f;
+		float start = staggeredStart ? offset : 0.f;
+		float end = glideSamples - stagger + offset;
+		float duration = std::max(end - start, 1.f);
+		start = std::min(start, glideSamples - duration);	// Even a strum spread over the whole glide ends with it
+		m_glideRate[voice * numNotes + i] = 1.f / duration;
+		m_glideSamples[voice * numNotes + i] = -start;
+	}
+	m_strummed[voice] = (stagger > 0.f);
+}
+
+// A new glide time or sample rate changes the increments of the glides under way, which carry on
+// from where they had got to. Their sample counts are rescaled to keep their phases.
+void ChordEngine::retimeGlides(float sampleTime, float glideSeconds)
+{
+	for( int voice = 0; voice < m_numVoices; voice++ ) {
+		if( m_glideIncrement[voice] > 0.f ) {
+			// As in startGlide(), a glide takes at least a sample
+			float increment = std::min(sampleTime / (m_glideScale[voice] * glideSeconds), 1.f);
+			float stretch = m_glideIncrement[voice] / increment;
+			m_glideIncrement[voice] = increment;
+			m_timerSamples[voice] *= stretch;
+			for( int channel = voice * m_prevNumNotes; channel < (voice + 1) * m_prevNumNotes; channel++ ) {
+				m_glideSamples[channel] *= stretch;
+				m_glideRate[channel] /= stretch;
+			}
+		}
+	}
+	m_sampleTime = sampleTime;
+	m_glideSeconds = glideSeconds;
+}
+
+void ChordEngine::SetSampleTime(float sampleTime)
+{
+	retimeGlides(sampleTime, m_glideSeconds);
+}
+
+void ChordEngine::Process(const ChordEngineSettings &settings, const float *voct, const float *gate, int numVoices, float sampleTime)
+{
+	int numNotes = settings.numNotes;
+	assert(numNotes >= 1 && numNotes <= maxJumbleNotes);
+	// A voice per input channel, for as many voices as there are output channels for
+	numVoices = std::max(1, std::min(numVoices, maxChordNotes / numNotes));
+
+	pitchOutputsChanged = false;
+	gateOutputsChanged = false;
+
+	// First we check that the number of notes (or voices) hasn't changed. Otherwise a mixture
+	// of sizes for fromPitches and toPitches could be disastrous!
+	bool numNotesChanged = (numNotes != m_prevNumNotes || numVoices != m_numVoices);
+	m_prevNumNotes = numNotes;
+	m_numVoices = numVoices;
+	if( numNotesChanged ) {
+		outputChannels = numVoices * numNotes;
+		// The rest is specialised for each chord size, and the size rarely changes
+		m_processChords = chordProcessors[numNotes - 1];
+		// Every voice starts afresh, and channels past the new last one mustn't glide
+		std::fill(m_glideRate, m_glideRate + maxChordNotes, 0.f);
+		std::fill(m_glideIncrement, m_glideIncrement + maxEngineVoices, 0.f);
+	}
+	if( sampleTime != m_sampleTime || settings.glideSeconds != m_glideSeconds ) {
+		retimeGlides(sampleTime, settings.glideSeconds);
+	}
+	(this->*m_processChords)(settings, voct, gate, numVoices, sampleTime, numNotesChanged);
+}
+
+template <int NumNotes>
+void ChordEngine::processChords(const ChordEngineSettings &settings, const float *voct, const float *gate, int numVoices, float sampleTime, bool numNotesChanged)
+{
+	const int numNotes = NumNotes;
+	assert(settings.numNotes == numNotes && numVoices <= maxChordNotes / numNotes);
+	int numBlocks = (numVoices + 3) / 4;
+
+	// The fast path caches are only good for the scale, key sig, mode and chord size they were filled for
+	if( settings.scale != m_cacheScale || settings.key != m_cacheKey || settings.mode != m_cacheMode || numNotes != m_cacheNumNotes ) {
+		std::fill(m_pressedStep, m_pressedStep + maxEngineVoices, INT_MIN);
+		std::fill(m_chordValid, m_chordValid + maxEngineVoices, false);
+		m_cacheScale = settings.scale;
+		m_cacheKey = settings.key;
+		m_cacheMode = settings.mode;
+		m_cacheNumNotes = numNotes;
+	}
+
+	// Keep the worker thread's table of rollovers in step with the knobs (cheap when they haven't moved)
+	TransitionParams transitionParams = {settings.key, settings.mode, numNotes, TransitionParams::QuantizeJumble(settings.jumbleAmount), settings.scale->Id()};
+	m_transitionTables.Request(transitionParams, *settings.scale);
+	// Likewise the glide curve, which is one of the tables baked in advance
+	m_glideCurve.Update(settings.curve, settings.profile);
+
+	// Four voices at a time: has each gate input been triggered this sample (a Schmitt trigger going
+	// from "unpressed" to "pressed"), and has each pitch input changed more than half a step of the tuning?
+	int gateOnBits = 0;
+	int pitchChangeBits = 0;
+	for( int block = 0; block < numBlocks; block++ ) {
+		float_4 gateV = float_4::load(gate + 4 * block);
+		float_4 high = gateV >= 1.f;
+		float_4 low = gateV <= 0.1f;
+		float_4 &state = m_triggerState[block];
+		gateOnBits |= movemask(high & ~state) << (4 * block);
+		state = high | (state & ~low);
+
+		float_4 pitchV = float_4::load(voct + 4 * block);
+		float_4 prevPitch = float_4::load(m_prevPitch + 4 * block);
+		pitchChangeBits |= movemask(fmax(pitchV - prevPitch, prevPitch - pitchV) > settings.scale->ChangeThreshold()) << (4 * block);
+	}
+
+	for( int voice = 0; voice < numVoices; voice++ ) {
+		int firstChannel = voice * numNotes;
+
+		// Is the current keypress pitch supported in the current key signature / mode?
+		bool invalidPress = false;
+		int note = notePressed(voice, voct[voice], settings, invalidPress);
+		if( !invalidPress ) {
+			m_lastValidNote[voice] = note;
+			m_gateSuppressed[voice] = false;
+		}
+
+		bool gateOn = (gateOnBits >> voice) & 1;
+		bool pitchChange = false;
+		if( invalidPress ) {
+			// The user pressed a key that's not in this key signature / mode. Act like it didn't happen
+			if( gateOn ) {
+				// It was a new keypress. Get rid of it altogether
+				gateOn = false;
+				// And supress the output gates for a while
+				m_gateSuppressed[voice] = true;
+				stats.outOfKeySuppressions.Add(1);
+			} else {
+				// It was a rollover to an invalid key
+				// gateOn is already false
+				// Leave the gate as it is, because it still relates to the key being rolled from
+			}
+		} else {
+			pitchChange = (pitchChangeBits >> voice) & 1;
+			m_prevPitch[voice] = voct[voice];
+		}
+
+		// Has the pitch changed without a gate trigger?
+		// (and we don't want to rollover if the number of notes has changed)
+		bool rollover = pitchChange && (!gateOn) && (!numNotesChanged);
+
+		// The voice's gate outputs are just copies of its input gate (unless suppressed by an out-of-key press)
+		float gateV = m_gateSuppressed[voice] ? 0.f : gate[voice];
+		if( numNotesChanged || gateV != m_prevGateOutput[voice] ) {
+			std::fill(gateOutputs + firstChannel, gateOutputs + firstChannel + numNotes, gateV);
+			m_prevGateOutput[voice] = gateV;
+			gateOutputsChanged = true;
+		}
+
+		if( (gateOn) || numNotesChanged ) {
+			// For a gateOn trigger, we are starting a chord
+			// We also do this when the user moves the "number of notes" knob
+			// (in that case, the "new" chord will only sound if the gate input is high, as this is copied to output gates)
+			const ChordPitches &pitches = currentChord(voice, settings);
+			std::copy(pitches.begin(), pitches.end(), m_fromPitches + firstChannel);
+			std::copy(pitches.begin(), pitches.end(), pitchOutputs + firstChannel);
+			std::copy(pitches.begin(), pitches.end(), m_toPitches + firstChannel);	// Only for Publish(), until the next glide
+			for( int i = 0; i < numNotes; i++ ) {
+				m_voiceTargets[firstChannel + i] = i;
+			}
+			m_fromNote[voice] = m_lastValidNote[voice];
+			m_toNote[voice] = m_lastValidNote[voice];
+			m_glideIncrement[voice] = 0.f;	// Indicate "no current slide"
+			std::fill(m_glideRate + firstChannel, m_glideRate + firstChannel + numNotes, 0.f);
+			m_brightness[voice] = 0.f;
+			pitchOutputsChanged = true;
+		} else if ( rollover ) {
+			stats.rollovers.Add(1);
+			startGlide<NumNotes>(voice, settings, transitionParams, sampleTime);
+		}
+	}
+
+	// Advance the glide timers, four voices at a time. A voice glides until its phase reaches 1, and
+	// ends its glide on the sample after. The phase is allowed to fall short of 1 by a rounding error,
+	// so that a glide of a whole number of samples takes exactly that many.
+	const float glideEnd = 1.f - 1e-6f;
+	float progress[maxEngineVoices];
+	int glidingBits = 0;
+	int endingBits = 0;
+	for( int block = 0; block < numBlocks; block++ ) {
+		float_4 samples = float_4::load(m_timerSamples + 4 * block);
+		float_4 increment = float_4::load(m_glideIncrement + 4 * block);
+		float_4 active = increment > 0.f;
+		float_4 gliding = active & (samples * increment < glideEnd);
+		endingBits |= movemask(active & ~gliding) << (4 * block);
+		glidingBits |= movemask(gliding) << (4 * block);
+		samples += gliding & float_4(1.f);
+		samples.store(m_timerSamples + 4 * block);
+		ifelse(gliding, fmin(samples * increment, float_4(1.f)), float_4::zero()).store(progress + 4 * block);
+	}
+
+	// Advance the gliding channels through their parts of their voices' glides, four channels at a
+	// time. Each one's progress along its part (before the glide curve), or -1 if it isn't gliding.
+	float channelProgress[maxChordNotes];
+	if( glidingBits ) {
+		for( int channel = 0; channel < outputChannels; channel += 4 ) {
+			float_4 rate = float_4::load(m_glideRate + channel);
+			float_4 gliding = rate > 0.f;
+			float_4 samples = float_4::load(m_glideSamples + channel) + (gliding & float_4(1.f));
+			samples.store(m_glideSamples + channel);
+			ifelse(gliding, fmin(fmax(samples * rate, float_4::zero()), float_4(1.f)), float_4(-1.f)).store(channelProgress + channel);
+		}
+	}
+
+	for( int voice = 0; voice < numVoices; voice++ ) {
+		int firstChannel = voice * numNotes;
+		if( m_glideIncrement[voice] == 0.f ) {
+			// No current glide
+			m_brightness[voice] = 0.f;
+		} else if( (glidingBits >> voice) & 1 ) {
+			// Mid glide. Unless it's strummed, the voice's channels are all at the same point on the glide curve.
+			if( m_strummed[voice] ) {
+				for( int channel = firstChannel; channel < firstChannel + numNotes; channel++ ) {
+					channelProgress[channel] = m_glideCurve.Lookup(channelProgress[channel]);
+				}
+			} else {
+				std::fill(channelProgress + firstChannel, channelProgress + firstChannel + numNotes, m_glideCurve.Lookup(channelProgress[firstChannel]));
+			}
+			// Light up the "Rollover" LED in a kinda linear way based on progress instead of a fixed length pulse
+			m_brightness[voice] = 1.f/3.f + 2.f * (1.f - progress[voice])/3.f;
+		} else if( (endingBits >> voice) & 1 ) {
+			// End point of glide. From now, act like this "always was" a flat unglided chord
+			// (and land exactly on it, whatever rounding there was along the way)
+			std::copy(m_toPitches + firstChannel, m_toPitches + firstChannel + numNotes, m_fromPitches + firstChannel);
+			std::copy(m_toPitches + firstChannel, m_toPitches + firstChannel + numNotes, pitchOutputs + firstChannel);
+			std::sort(m_fromPitches + firstChannel, m_fromPitches + firstChannel + numNotes);	// Seems sensible in the face of a slight bug
+			pitchOutputsChanged = true;
+			std::fill(m_glideRate + firstChannel, m_glideRate + firstChannel + numNotes, 0.f);
+			std::fill(channelProgress + firstChannel, channelProgress + firstChannel + numNotes, -1.f);
+			m_fromNote[voice] = m_toNote[voice];
+			m_glideIncrement[voice] = 0.f;
+		}
+	}
+
+	// Interpolate the gliding voices' channels between fromPitches and toPitches, four channels at a time.
+	// Other channels hold their pitches (which keep the order that their last glide left them in).
+	if( glidingBits ) {
+		for( int channel = 0; channel < outputChannels; channel += 4 ) {
+			float_4 y = float_4::load(channelProgress + channel);
+			float_4 glided = y * float_4::load(m_toPitches + channel) + (1.f - y) * float_4::load(m_fromPitches + channel);
+			ifelse(y >= 0.f, glided, float_4::load(pitchOutputs + channel)).store(pitchOutputs + channel);
+		}
+		pitchOutputsChanged = true;
+	}
+
+	rolloverBrightness = 0.f;
+	for( int voice = 0; voice < numVoices; voice++ ) {
+		rolloverBrightness = std::max(rolloverBrightness, m_brightness[voice]);
+	}
+}
+
+void ChordEngine::Publish(ChordExpanderMessage &message) const
+{
+	message.magic = chordExpanderMagic;
+	message.version = chordExpanderVersion;
+	message.key = m_cacheKey;
+	message.mode = m_cacheMode;
+	message.notesPerOctave = m_cacheScale ? m_cacheScale->NotesPerOctave() : 0;
+	message.numNotes = m_prevNumNotes;
+	message.numVoices = m_numVoices;
+	message.outputChannels = m_cacheScale ? outputChannels : 0;	// Nothing until the first Process()
+	for( int channel = 0; channel < message.outputChannels; channel++ ) {
+		int voice = channel / m_prevNumNotes;
+		message.degrees[channel] = m_toNote[voice] + m_cacheScale->ChordDegree(m_toNote[voice], m_cacheMode, m_voiceTargets[channel]);
+		message.targetPitches[channel] = m_toPitches[channel];
+		message.permutation[channel] = m_voiceTargets[channel];
+		// Where the last Process() left the channel. Waiting to set off in a strum is 0.
+		float progress = 1.f;
+		if( m_glideIncrement[voice] > 0.f && m_glideRate[channel] > 0.f ) {
+			progress = m_glideCurve.Lookup(std::min(std::max(m_glideSamples[channel] * m_glideRate[channel], 0.f), 1.f));
+		}
+		message.glideProgress[channel] = progress;
+	}
+}
+
+const ChordEngine::ChordProcessor ChordEngine::chordProcessors[maxChordNotes] = {
+	&ChordEngine::processChords<1>, &ChordEngine::processChords<2>, &ChordEngine::processChords<3>, &ChordEngine::processChords<4>,
+	&ChordEngine::processChords<5>, &ChordEngine::processChords<6>, &ChordEngine::processChords<7>, &ChordEngine::processChords<8>,
+	&ChordEngine::processChords<9>, &ChordEngine::processChords<10>, &ChordEngine::processChords<11>, &ChordEngine::processChords<12>,
+	&ChordEngine::processChords<13>, &ChordEngine::processChords<14>, &ChordEngine::processChords<15>, &ChordEngine::processChords<16>
+};
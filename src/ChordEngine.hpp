@@ -0,0 +1,170 @@
+#pragma once
+
+// The chord rollover state machine, which turns V/Oct and gate inputs into polyphonic chords that
+// glide from one to the next when the player rolls over from one key to another.
+// Each input channel drives its own voice of the state machine. The voices' state is kept as
+// structure-of-arrays, so that the per-sample work can be done four voices at a time.
+// Like ChordCore, this doesn't depend on Rack (apart from using Rack's float_4 in the plugin).
+
+#include "ChordCore.hpp"
+#include "ChordExpander.hpp"
+#include "GlideCurve.hpp"
+#include "Profiling.hpp"
+#include "SimdCompat.hpp"
+#include "TransitionTable.hpp"
+
+const int maxEngineVoices = maxChordNotes;				// One voice per input channel, up to Rack's limit
+const int maxEngineBlocks = maxEngineVoices / 4;		// float_4s needed for one value per voice
+static_assert(chordExpanderChannels == maxChordNotes, "The expander message has a slot for each output channel");
+
+// How the notes of a chord are staggered through a glide, in the order of the module's strum param.
+// "Lowest" is the chord's first output channel, which is its lowest note unless it is jumbled.
+enum StrumMode
+{
+	NO_STRUM,				// Every note glides for the whole glide time
+	STRUM_START_UP,			// The notes set off one after another, lowest first, each gliding for the same time
+	STRUM_START_DOWN,		// Likewise, highest first
+	STRUM_ARRIVE_UP,		// The notes set off together, and arrive one after another, lowest first
+	STRUM_ARRIVE_DOWN,		// Likewise, highest first
+	NUM_STRUM_MODES
+};
+
+const char *strumModeName(int strum);
+
+// The knobs, in the module's param order
+enum EngineParam
+{
+	KEYSIG_ENGINE_PARAM,
+	MODE_ENGINE_PARAM,
+	CHORD_ENGINE_PARAM,
+	TIME_ENGINE_PARAM,
+	PROFILE_ENGINE_PARAM,
+	JUMBLE_ENGINE_PARAM,
+	CURVE_ENGINE_PARAM,
+	STRUM_ENGINE_PARAM,
+	SPREAD_ENGINE_PARAM,
+	NUM_ENGINE_PARAMS
+};
+
+// What the knobs are set to
+struct ChordEngineSettings
+{
+	const Scale *scale;		// Must outlive the engine, as the jumble worker may still be using it
+	int key;
+	int mode;
+	int numNotes;
+	float glideSeconds;
+	float profile;
+	float jumbleAmount;
+	int curve;				// A GlideCurve
+	int strum;				// A StrumMode
+	float strumSpread;		// The fraction of the glide time that a strum staggers the notes over
+
+	// From the knobs' values, NUM_ENGINE_PARAMS of them in EngineParam order
+	static ChordEngineSettings FromParams(const Scale *scale, const float *params)
+	{
+		ChordEngineSettings settings;
+		settings.scale = scale;
+		settings.key = (int)params[KEYSIG_ENGINE_PARAM];
+		settings.mode = (int)params[MODE_ENGINE_PARAM];
+		settings.numNotes = (int)params[CHORD_ENGINE_PARAM];
+		settings.glideSeconds = params[TIME_ENGINE_PARAM];
+		settings.profile = params[PROFILE_ENGINE_PARAM];
+		settings.jumbleAmount = params[JUMBLE_ENGINE_PARAM];
+		settings.curve = (int)params[CURVE_ENGINE_PARAM];
+		settings.strum = (int)params[STRUM_ENGINE_PARAM];
+		settings.strumSpread = params[SPREAD_ENGINE_PARAM];
+		return settings;
+	}
+};
+
+class ChordEngine
+{
+	public:
+		// Outputs. Like Rack's ports, these hold their values between samples.
+		// Voice v's chord is on channels v * numNotes to v * numNotes + numNotes - 1.
+		float pitchOutputs[maxChordNotes];
+		float gateOutputs[maxChordNotes];
+		int outputChannels;
+		bool pitchOutputsChanged;	// True if the last Process() changed pitchOutputs or outputChannels
+		bool gateOutputsChanged;	// True if the last Process() changed gateOutputs or outputChannels
+		float rolloverBrightness;	// For the rollover light
+		EngineStats stats;			// Counts of what the engine has been up to
+
+		// A synchronous engine works out jumbles as it needs them, rather than on a worker thread,
+		// so that its outputs don't depend on thread timing (see TransitionTableBuilder)
+		explicit ChordEngine(bool synchronousTables = false);
+		// Forget everything cached, and output the chords and gates afresh on the next Process()
+		void Invalidate();
+		// One sample. numVoices is the number of input channels; voct and gate must each have
+		// maxEngineVoices entries (one per input channel) so that they can be read four at a time.
+		void Process(const ChordEngineSettings &settings, const float *voct, const float *gate, int numVoices, float sampleTime);
+		// Retimes the glides for a new sample rate (Process() does this too, but this keeps it off the
+		// audio thread's next sample when Rack tells us)
+		void SetSampleTime(float sampleTime);
+		// Describes the chords as of the last Process(), for the module's expanders
+		void Publish(ChordExpanderMessage &message) const;
+		int NumVoices() const {return m_numVoices;}
+		const JumbleStats &JumbleStatistics() const {return m_transitionTables.Stats();}
+
+	private:
+		// Process() after it has checked the chord size, specialised for each size
+		typedef void (ChordEngine::*ChordProcessor)(const ChordEngineSettings &settings, const float *voct, const float *gate, int numVoices, float sampleTime, bool numNotesChanged);
+		static const ChordProcessor chordProcessors[maxChordNotes];	// Indexed by the number of notes - 1
+
+		int m_prevNumNotes;							// The number of notes in the chord (a param) from the previous Process()
+		int m_numVoices;							// The number of voices in the previous Process()
+		float m_sampleTime;							// The sample time that the glide increments are for
+		float m_glideSeconds;						// ...and the glide time
+		ChordProcessor m_processChords;				// The specialisation for m_prevNumNotes
+		TransitionTableBuilder m_transitionTables;	// Works out the jumbles for rollovers, away from the audio thread
+		DiagnosticChannel m_diagnostics;			// For reporting from the audio thread
+		GlideCurveTable m_glideCurve;				// The glide curve for the curve and profile knobs
+
+		// Per voice state
+		float_4 m_triggerState[maxEngineBlocks];	// Schmitt trigger for each gate input, as a mask that is set while high
+		float m_prevPitch[maxEngineVoices];			// The pitch input from the previous Process()
+		// A voice's progress along its glide (its phase) is its timer times its increment, the fraction of
+		// the glide that passes each sample. This is kept as a sample count rather than by adding up the
+		// increments, which would lose precision over long glides at high sample rates.
+		float m_timerSamples[maxEngineVoices];		// The number of samples that we are "into" a slide, at the current increment
+		float m_glideIncrement[maxEngineVoices];	// The fraction of the slide per sample. 0 means no slide.
+		float m_glideScale[maxEngineVoices];		// The slide's length as a fraction of the glide time
+		int m_lastValidNote[maxEngineVoices];		// The last valid note pressed (valid in this key sig / mode)
+		bool m_gateSuppressed[maxEngineVoices];		// We hold this true from when a new keypress is not in the correct key
+		int m_fromNote[maxEngineVoices];			// The note whose chord the voice's fromPitches holds, when not mid glide
+		int m_toNote[maxEngineVoices];				// The note whose chord the voice's toPitches holds
+		float m_brightness[maxEngineVoices];		// The voice's contribution to the rollover light
+		bool m_strummed[maxEngineVoices];			// Whether the voice's channels glide at different times
+		float m_prevGateOutput[maxEngineVoices];	// The voltage last written to the voice's gate outputs
+
+		// Per output channel state
+		float m_fromPitches[maxChordNotes];			// The pitches in the chords we're interpolating from
+		float m_toPitches[maxChordNotes];			// The pitches in the chords we're intepolating to
+		uint8_t m_voiceTargets[maxChordNotes];		// The notes of the voice's chord (from the lowest) that toPitches are
+		// Each channel glides through its own part of its voice's glide (see StrumMode). Its progress
+		// along its glide is the samples it is into its part times its rate, the reciprocal of the part's
+		// length. Like the voice's timer, these are in samples at the voice's current increment.
+		float m_glideSamples[maxChordNotes];		// Negative while the channel waits to set off
+		float m_glideRate[maxChordNotes];			// 0 while the channel isn't gliding
+
+		// Steady-state fast path. Nothing is recalculated unless one of the things it depends on has changed.
+		const Scale *m_cacheScale;					// The scale the caches below were filled for
+		int m_cacheKey;								// ...and the key sig
+		int m_cacheMode;							// ...and the mode
+		int m_cacheNumNotes;						// ...and the number of notes
+		int m_pressedStep[maxEngineVoices];			// The quantized pitch input that pressedNote was looked up for
+		int m_pressedNote[maxEngineVoices];			// The note within key sig for the above
+		bool m_pressedOutOfKey[maxEngineVoices];	// Whether pressedStep is out of key
+		bool m_chordValid[maxEngineVoices];			// False forces the chord to be rebuilt
+		int m_chordNote[maxEngineVoices];			// The valid note that the chord was built on
+		ChordPitches m_chords[maxEngineVoices];		// The chord for the voice's last valid note pressed
+
+		void retimeGlides(float sampleTime, float glideSeconds);
+		int notePressed(int voice, float voct, const ChordEngineSettings &settings, bool &invalidPress);
+		const ChordPitches &currentChord(int voice, const ChordEngineSettings &settings);
+		template <int NumNotes>
+		void processChords(const ChordEngineSettings &settings, const float *voct, const float *gate, int numVoices, float sampleTime, bool numNotesChanged);
+		template <int NumNotes>
+		void startGlide(int voice, const ChordEngineSettings &settings, const TransitionParams &transitionParams, float sampleTime);
+};
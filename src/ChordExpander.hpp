@@ -0,0 +1,42 @@
+#pragma once
+
+// What ChordRollover tells the modules either side of it about its chords, for companion modules
+// (per-voice splitters, chord displays, further voicings) that would otherwise need their own
+// ChordRollover working out the same thing.
+//
+// ChordRollover publishes through Rack's expander messages, on its own leftExpander and
+// rightExpander. Both sides share one pair of messages: on each sample that the chords or settings
+// change (and the one after), it writes the producer message and asks for both sides to be flipped,
+// so a neighbour reads the previous sample's chords with no copying on its part. In between, both
+// messages hold the current chords. A module to the right reads it with
+//
+//     Module* chords = leftExpander.module;
+//     const ChordExpanderMessage* message = chords ? (const ChordExpanderMessage*)chords->rightExpander.consumerMessage : NULL;
+//     if( message && message->magic == chordExpanderMagic && message->version == chordExpanderVersion ) ...
+//
+// and a module to the left likewise, with rightExpander.module and leftExpander.consumerMessage.
+// This header doesn't depend on Rack, so that other plugins can copy it.
+
+#include <cstdint>
+
+const uint32_t chordExpanderMagic = 0x43524f4c;		// "CROL"
+const int chordExpanderVersion = 1;
+const int chordExpanderChannels = 16;				// Rack's polyphony, which is as many as the engine outputs
+
+struct ChordExpanderMessage
+{
+	uint32_t magic;				// chordExpanderMagic, to tell the message from other modules' messages
+	int32_t version;			// chordExpanderVersion. Fields are only ever added at the end.
+	int32_t key;				// The key sig and mode, as the module's knobs and CVs set them
+	int32_t mode;
+	int32_t notesPerOctave;		// The notes in an octave of the scale in use
+	int32_t numNotes;			// Notes per chord
+	int32_t numVoices;			// Voices, one per input channel. Voice v has channels v * numNotes to v * numNotes + numNotes - 1.
+	int32_t outputChannels;		// numVoices * numNotes
+
+	// Per output channel
+	int32_t degrees[chordExpanderChannels];			// The note that the channel is on or gliding to, in notes of the scale in the mode (0 being the key's root at 0V)
+	float targetPitches[chordExpanderChannels];		// Its pitch (V/Oct)
+	float glideProgress[chordExpanderChannels];		// How far it is along its glide (after the glide curve), 1 once it has arrived
+	uint8_t permutation[chordExpanderChannels];		// Which note of its voice's chord, from the lowest, it is on or gliding to (the jumble)
+};
@@ -1,278 +1,13 @@
 #include "plugin.hpp"
-#include <cfloat>
-
-const char* whiteNoteIntervals = "TTSTTTS";
-
-int niceModulo(int x, int y)
-{
-	int z = x % y;
-	if( z >=0 ) {
-		return z;
-	}
-	return z + y;
-}
-
-std::string generateModeString(int mode)
-{
-	assert( mode >= 0 );
-	assert( mode < 7 );
-
-	std::string result = "0123456\0";
-	for( int i=0; i<7; i++ ) {
-		result[i] = whiteNoteIntervals[(i+ mode) % 7];
-	}
-	result[7] = '\0';
-	return result;
-}
-
-int voltageToNearestSemi(float voltage)
-{
-	return (int)(round(voltage * 12.f));
-}
-
-// semi can be negative
-// returns a note that also incorporates the octave
-int semiToNoteWithinKeySig(int semi, int key, std::string modeString, bool *outOfKey)
-{
-	assert(key >= 0);
-	assert(key <= 11);
-	assert(modeString[7] == '\0');
-
-	int semiToTry = key;
-	*outOfKey = false;
-	int semiModulo12 = niceModulo(semi, 12);
- 	for( int noteToTry = 0; noteToTry <= 6; noteToTry++ ) {
-		if( semiModulo12 == niceModulo(semiToTry, 12) ) {
-			// Found a matching note, now find the octave
-			for( int octave = -10; octave < 10; octave++ ) {
-				if( semi == semiToTry + octave * 12 ) {
-					return noteToTry + octave * 7;
-				}
-			}
-		}
-		if( modeString[noteToTry] == 'T' ) {
-			semiToTry += 2;
-		} else {
-			semiToTry += 1;
-		}
-	}
-	// No exact match. Find the match that works when we start a semi lower...
-	*outOfKey = true;
-	semiToTry = key;
-	semi -= 1;
-	semiModulo12 = niceModulo(semi, 12);
-	for( int noteToTry = 0; noteToTry <= 6; noteToTry++ ) {
-		if( semiModulo12 == niceModulo(semiToTry, 12) ) {
-			// Found a matching note, now find the octave
-			for( int octave = -10; octave < 10; octave++ ) {
-				if( semi == semiToTry + octave * 12 ) {
-					return noteToTry + octave * 7;
-				}
-			}
-		}
-		if( modeString[noteToTry] == 'T' ) {
-			semiToTry += 2;
-		} else {
-			semiToTry += 1;
-		}
-	}
-	// That didn't match either. Impossible!
-	assert(false);
-	return 0;
-}
-
-int noteToSemiWithinKeySig(int note, int key, std::string modeString)
-{
-	int semi = key;
-	// First shift by whole octaves
-	while( note < 0 ) {
-		semi -= 12;
-		note += 7;
-	}
-	for( int stepNote = 1; stepNote <= note; stepNote++ ) {
-		int modeIndex = (stepNote -1) % 7 ;
-		if( modeString[modeIndex] == 'T' ) {
-			semi += 2;
-		} else {
-			semi += 1;
-		}
-	}
-	return semi;
-}
-
-void testKeyMode(int key, int mode)
-{
-	std::string modeString = generateModeString(mode);
-	for( int semi = 0; semi <= 11; semi++ ) {
-		bool outOfKey = false;
-		int note = semiToNoteWithinKeySig(semi, key, modeString, &outOfKey);
-		int semiCalc = noteToSemiWithinKeySig(note, key, modeString);
-		assert(semiCalc == semi || outOfKey);
-	}
-}
-
-void meanStandardDeviation(const std::vector<float>& data, float &mean, float &stdDev)
-{
-	float sum = 0.f;
-	float sum_of_squares = 0.f;
-	unsigned int n = data.size();
-
-	for( unsigned int i = 0; i < n; i++ ) {
-		sum += data[i];
-		sum_of_squares += (data[i] * data[i]);
-	}
-
-	mean = sum / n;
-	float variance = (sum_of_squares - (sum * sum / n)) / (n - 1);
-	stdDev = sqrt(variance);
-}
-
-// A primary and secondary score for comparing "jumbledness" of chord mappings.
-class JumbleScore
-{
-	private:
-		int m_permutationIndex;
-		bool m_pleaseAvoid;		// True if this jumbling is to be avoided due to a note not changing
-		float m_primaryScore;
-		float m_secondaryScore;
-	public:
-		JumbleScore(int permutationIndex, float primaryScore, float secondaryScore, bool pleaseAvoid)
-		: m_permutationIndex(permutationIndex)
-		, m_pleaseAvoid(pleaseAvoid)
-		, m_primaryScore(primaryScore)
-		, m_secondaryScore(secondaryScore)
-		{
-		}
-		bool PleaseAvoid() {return m_pleaseAvoid;}
-		int PermutationIndex() {return m_permutationIndex;}
-		bool operator<(const JumbleScore &other)
-		{
-			if(m_primaryScore < other.m_primaryScore) {return true;}
-			if(m_primaryScore > other.m_primaryScore) {return false;}
-			if(m_secondaryScore < other.m_secondaryScore) {return true;}
-			return false;
-		}
-};
-
-// Biggest score is most jumbled, with primary score in result[0] and secondary score in result[1].
-// result[2] is important - it is 1.f to indicate that the mapping contains a note that does not
-// change (0.f otherwise). If result[2] is 1.f, reserve it for emergencies when no vectors include result[2] = 0.f!
-JumbleScore jumblednessScore(int permutationIndex, const std::vector<float>& toChordPitches, const std::vector<float>& fromChordPitches)
-{
-	std::vector<float> pitchChange = toChordPitches;
-	for( unsigned int i = 0; i < toChordPitches.size(); i++ ) {
-		pitchChange[i] -= fromChordPitches[i];
-	}
-
-	float meanPitchChange = 0.f;
-	float stdDevPitchChange = 0.f;
-	meanStandardDeviation(pitchChange, meanPitchChange, stdDevPitchChange);
-
-	float minAbsChange = FLT_MAX;
-	for( unsigned int i = 0; i < pitchChange.size(); i++ ) {
-		minAbsChange = std::min(minAbsChange, abs(pitchChange[i]));
-	}
-	bool anyNotesSame = (minAbsChange < 1.f / 12.f / 5.f);	// Difference less than 5th of a semitone
-
-	return JumbleScore(permutationIndex, stdDevPitchChange, minAbsChange, anyNotesSame);
-}
-
-std::vector<float> jumbleChord(const std::vector<float> &toChordPitches, const std::vector<float> &fromChordPitches, float jumbleAmount)
-{
-	assert(toChordPitches.size() == fromChordPitches.size());
-
-	std::vector<float> candidateToPitches = toChordPitches;
-	// Important: sort it first, to get the lexicographically smallest permutation
-	std::sort(candidateToPitches.begin(), candidateToPitches.end());
-
-	// Firstly, if jumbleAmount is 0.0, and fromChordPitches is sorted, simply sort toChordPitches
-	if( jumbleAmount==0.f )
-	{
-		std::vector<float> sortedFrom = fromChordPitches;
-		std::sort(sortedFrom.begin(), sortedFrom.end());
-		if( sortedFrom==fromChordPitches ) {
-			INFO( "Bypassing jumble as jumbleAmount==0.0 and fromChordPitches is sorted" );
-			return candidateToPitches;
-		}
-	}
-
-	// We gather a score for every permutation, each in either "allowed" or "avoidable" vectors
-	std::vector<JumbleScore> allowedScores;
-	std::vector<JumbleScore> avoidableScores;
-
-	int permutationIndex = 0;
-	do {
-		JumbleScore score = jumblednessScore(permutationIndex, candidateToPitches, fromChordPitches);
-		if( score.PleaseAvoid() ) {
-			avoidableScores.push_back(score);
-		} else {
-			allowedScores.push_back(score);
-		}
-		permutationIndex++;
-	} while (std::next_permutation(candidateToPitches.begin(), candidateToPitches.end()));
-
-	int chosenPermutationIndex = -1;
-	if( allowedScores.size() > 0 ) {
-		int last = allowedScores.size() - 1;
-		// Choose somewhere between first and last based on jumbleAmount
-		int index = (int) (jumbleAmount * last);
-		std::sort(allowedScores.begin(), allowedScores.end());
-		chosenPermutationIndex = allowedScores[index].PermutationIndex();
-	} else {
-		// Not ideal, but resort to PleaseAvoid permutations
-		int last = avoidableScores.size() - 1;
-		// Choose somewhere between first and last based on jumbleAmount
-		int index = (int) (jumbleAmount * last);
-		std::sort(avoidableScores.begin(), avoidableScores.end());
-		chosenPermutationIndex = avoidableScores[index].PermutationIndex();
-	}
-	// candidateToPitches() was reverted to the first lexicographical order at the end of the above loop
-	for( int i=0; i<chosenPermutationIndex; i++ ) {
-		std::next_permutation(candidateToPitches.begin(), candidateToPitches.end());
-	}
-	return candidateToPitches;
-}
-
-void runTests()
-{
-	assert(voltageToNearestSemi(0.f) == 0);
-	assert(voltageToNearestSemi(1.f) == 12);
-	assert(voltageToNearestSemi(-1.f) == -12);
-	assert(voltageToNearestSemi(1.f / 12.f) == 1);
-	assert(voltageToNearestSemi(11.f / 12.f) == 11);
-
-	for( int key = 0; key < 12; key++ )
-	{
-		for( int mode = 0; mode < 7; mode++ )
-		{
-			testKeyMode(key,mode);
-		}
-	}
-
-	bool outOfKey = false;
-	std::string modeString = generateModeString(0);
-	assert(semiToNoteWithinKeySig(0,0,modeString,&outOfKey)==0);	// C in C Major Ionian
-	assert(outOfKey==false);
-	assert(semiToNoteWithinKeySig(1,0,modeString,&outOfKey)==0);	// C# in C Major Ionian
-	assert(outOfKey==true);
-	assert(semiToNoteWithinKeySig(2,0,modeString,&outOfKey)==1);	// D in C Major Ionian
-	assert(outOfKey==false);
-	assert(semiToNoteWithinKeySig(9,11,modeString,&outOfKey)==5-7);	// A in B Major Ionian
-	assert(outOfKey==true);
-	modeString = generateModeString(1);
-	assert(semiToNoteWithinKeySig(9,11,modeString,&outOfKey)==6-7);	// A in B Dorian
-	assert(outOfKey==false);
-
-	std::vector<float> from;
-	std::vector<float> to;
-	from.push_back(1.f);
-	from.push_back(2.f);
-	to.push_back(3.f);
-	to.push_back(5.f);
-	jumbleChord(from, to, 0.5);
-}
-
-int chordNotes[8] = {0,2,4,7,9,11,14,16};	// Room for a heptad plus first inversion
+#include "AllocCounter.hpp"
+#include "ChordCore.hpp"
+#include "ChordEngine.hpp"
+#include "ControlParams.hpp"
+#include "TraceRecorder.hpp"
+#include "TransitionTable.hpp"
+#include <osdialog.h>
+#include <fstream>
+#include <sstream>
 
 struct ChordRollover : Module {
 	enum ParamId {
@@ -282,11 +17,20 @@ struct ChordRollover : Module {
 		TIME_PARAM,
 		PROFILE_PARAM,
 		JUMBLE_PARAM,
+		CURVE_PARAM,	// No knob, set from the context menu
+		STRUM_PARAM,	// Likewise
+		SPREAD_PARAM,	// Likewise
 		PARAMS_LEN
 	};
 	enum InputId {
 		VOCT_INPUT,
 		GATE_INPUT,
+		KEYSIG_CV_INPUT,	// The CV inputs are in the order of the params they move
+		MODE_CV_INPUT,
+		CHORD_CV_INPUT,
+		TIME_CV_INPUT,
+		PROFILE_CV_INPUT,
+		JUMBLE_CV_INPUT,
 		INPUTS_LEN
 	};
 	enum OutputId {
@@ -299,236 +43,337 @@ struct ChordRollover : Module {
 		LIGHTS_LEN
 	};
 
-	dsp::SchmittTrigger trigger;		// A handler for the gate input, debouncing kind of thing
-	float prevPitch = 0.0;				// The pitch input from the previous process()
-	int prevNumNotes = -1;				// The number of notes in the chord (a param) from the previous process()
-	std::vector<float> fromPitches;		// The pitches in the chord we're interpolating from
-	std::vector<float> toPitches;		// The pitches in the chord we're intepolating to (guaranteed same size)
-	int lastValidNotePressed = 0;		// The last valid note pressed (valid in this key sig / mode)
-	int timerSamples = 0;				// The number of samples that we are "into" a slide
-	int timerTarget = 0;				// The time (in samples) that we are expecting to end the slide. 0 means no slide.
-	bool gateSuppressed = false;		// We hold this true from when a new keypress is not in the correct key
+	// Where the scale in use came from, to be saved with the patch
+	enum ScaleSource {
+		BUILT_IN_SCALE,
+		EQUAL_DIVISION_SCALE,
+		SCALA_SCALE
+	};
+	ScaleSource scaleSource = BUILT_IN_SCALE;
+	int builtInScaleIndex = DIATONIC_SCALE;
+	int equalDivisionSteps = 12;
+	std::string scalaText;
+	// Scales are compiled on the UI thread when they are chosen. They are kept until the module is
+	// destroyed (after the engine), as the audio thread and the transition table worker may still be
+	// reading the one that was replaced. Choosing the same scale again reuses it.
+	std::vector<std::pair<std::string, std::unique_ptr<Scale>>> compiledScales;
+	std::atomic<const Scale*> scale;	// The scale in use, read by process()
+
+	ChordEngine engine;					// The chord rollover logic, with a voice for each input channel
+	ProcessStats processStats;			// How long process() takes
+	TraceRecorder recorder;				// Records what process() is given and what it outputs, when asked to
+	ControlParams controls;				// The knobs and CVs, read at the control rate
+	ChordEngineSettings settings;		// Made from controls, when any of them change
+	ChordExpanderMessage expanderMessages[2];	// Shared by both expanders (see ChordExpander.hpp)
+	int expanderPublishes = 0;			// Samples left to publish the chords to the expanders on (see process())
+
+	static_assert((int)PARAMS_LEN == (int)NUM_ENGINE_PARAMS && (int)SPREAD_PARAM == (int)SPREAD_ENGINE_PARAM, "The engine and traces take the params in this order");
+	static_assert(JUMBLE_CV_INPUT - KEYSIG_CV_INPUT + 1 == numControlInputs, "ControlParams takes a CV for each param up to JUMBLE");
 
 	ChordRollover() {
-		INFO("ChordRollover: Running Tests...");
-		runTests();
-		INFO("ChordRollover: ...Tests completed");
-
+		setBuiltInScale(DIATONIC_SCALE);
 		config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
 		configSwitch(KEYSIG_PARAM, 0.f, 11.f, 0.f, "Key Signature", {"C", "C♯/D♭", "D", "D♯/E♭", "E", "F", "F♯/G♭", "G", "G♯/A♭", "A", "A♯/B♭", "B"});
 		configSwitch(MODE_PARAM, 0.f, 6.f, 0.f, "Mode", {"Ionian (Major)", "Dorian", "Phrygian", "Lydian", "Mixolydian", "Aeolian (Minor)", "Locrian"});
-		configSwitch(CHORD_PARAM, 1.f, 7.f, 4.f, "Notes in chord", {"Monad", "Diad", "Triad", "Tetrad", "Pentad", "Hexad", "Heptad"});
+		configSwitch(CHORD_PARAM, 1.f, 16.f, 4.f, "Notes in chord", {"Monad", "Diad", "Triad", "Tetrad", "Pentad", "Hexad", "Heptad",
+			"8 (extended)", "9 (extended)", "10 (extended)", "11 (extended)", "12 (extended)", "13 (extended)", "14 (extended)", "15 (extended)", "16 (extended)"});
 		configParam(TIME_PARAM, 0.001f, 5.f, 0.5f, "Glide time (s)" );
-		configParam(PROFILE_PARAM, 1.f, 10.f, 1.f, "Glide profile (1 for triangle, 10 for step)");
+		configParam(PROFILE_PARAM, 1.f, 10.f, 1.f, "Glide profile (1 for linear, 10 for the most bent glide curve)");
 		configParam(JUMBLE_PARAM, 0.f, 1.f, 0.f, "Jumble Amount");
-		configInput(VOCT_INPUT, "(Mono) Pitch");
-		configInput(GATE_INPUT, "(Mono) Gate");
+		std::vector<std::string> curveNames;
+		for( int curve = 0; curve < NUM_GLIDE_CURVES; curve++ ) {
+			curveNames.push_back(glideCurveName(curve));
+		}
+		configSwitch(CURVE_PARAM, 0.f, NUM_GLIDE_CURVES - 1, SIGMOID_GLIDE_CURVE, "Glide curve", curveNames);
+		std::vector<std::string> strumNames;
+		for( int strum = 0; strum < NUM_STRUM_MODES; strum++ ) {
+			strumNames.push_back(strumModeName(strum));
+		}
+		configSwitch(STRUM_PARAM, 0.f, NUM_STRUM_MODES - 1, NO_STRUM, "Strum", strumNames);
+		configParam(SPREAD_PARAM, 0.f, 1.f, 0.5f, "Strum spread", "% of glide time", 0.f, 100.f);
+		configInput(VOCT_INPUT, "(Poly) Pitch, a chord for each channel");
+		configInput(GATE_INPUT, "(Poly) Gate, one for each pitch channel (or mono for all)");
+		configInput(KEYSIG_CV_INPUT, "Key signature CV (1V/Oct, added to the knob)");
+		configInput(MODE_CV_INPUT, "Mode CV (1V per mode)");
+		configInput(CHORD_CV_INPUT, "Notes in chord CV (1V per note)");
+		configInput(TIME_CV_INPUT, "Glide time CV (0.5s per volt)");
+		configInput(PROFILE_CV_INPUT, "Glide profile CV (0V to 10V for the whole range)");
+		configInput(JUMBLE_CV_INPUT, "Jumble amount CV (0V to 10V for the whole range)");
 		configOutput(VOCT_OUTPUT, "(Poly) Pitch");
 		configOutput(GATE_OUTPUT, "(Poly) Gate");
-	}
-
-	int notePressed(bool &invalidPress) {
-		int key = (int)(params[KEYSIG_PARAM].getValue());
-		int mode = (int)(params[MODE_PARAM].getValue());
-		std::string modeString = generateModeString(mode);
 
-		float voct = inputs[VOCT_INPUT].getVoltage();
-		int semi = voltageToNearestSemi(voct);
+		// Both sides publish the same message, so they share the pair. That only works while both are
+		// flipped together: Rack flips each side's pointers separately, and if only one side flipped,
+		// the producer of one would be the consumer of the other, and a neighbour would read the
+		// message as it was written. So process() always requests both flips, or neither.
+		leftExpander.producerMessage = rightExpander.producerMessage = &expanderMessages[0];
+		leftExpander.consumerMessage = rightExpander.consumerMessage = &expanderMessages[1];
+		engine.Publish(expanderMessages[0]);
+		engine.Publish(expanderMessages[1]);
+	}
 
-		return semiToNoteWithinKeySig(semi, key, modeString, &invalidPress);
+	void onReset(const ResetEvent& e) override {
+		Module::onReset(e);
+		setBuiltInScale(DIATONIC_SCALE);
+		engine.Invalidate();
 	}
 
-	std::vector<float> constructChord(int validNote) {
-		int key = (int)(params[KEYSIG_PARAM].getValue());
-		int mode = (int)(params[MODE_PARAM].getValue());
-		std::string modeString = generateModeString(mode);
+	void onSampleRateChange(const SampleRateChangeEvent& e) override {
+		// Glides under way carry on at the new rate
+		Module::onSampleRateChange(e);
+		engine.SetSampleTime(e.sampleTime);
+	}
 
-		// The user has selected the number of notes in the chord on a knob
-		unsigned int numNotes = (int)(params[CHORD_PARAM].getValue());
+	void onUnBypass(const UnBypassEvent& e) override {
+		// Rack clears our outputs while we are bypassed
+		Module::onUnBypass(e);
+		engine.Invalidate();
+	}
 
-		// These integers are "nth note within key signature" from pressed root
-		std::vector<int> notes;
-		for( unsigned int noteIndex = 0; noteIndex < numNotes; noteIndex++ ) {
-			int thisNote = validNote + chordNotes[noteIndex];
-			notes.push_back(thisNote);
+	// The compiled scale with this key, or newScale (which is kept) if there isn't one yet
+	const Scale *keepScale(const std::string &key, std::unique_ptr<Scale> newScale) {
+		for( auto &compiled : compiledScales ) {
+			if( compiled.first == key ) {
+				return compiled.second.get();
+			}
 		}
+		compiledScales.push_back(std::make_pair(key, std::move(newScale)));
+		return compiledScales.back().second.get();
+	}
 
-		// Convert to semitones within key signature
-		std::vector<int> semis;
-		for( unsigned int noteIndex = 0; noteIndex < numNotes; noteIndex++ ) {
-			int thisSemi = noteToSemiWithinKeySig(notes[noteIndex], key, modeString);
-			semis.push_back(thisSemi);
+	void useScale(const Scale *newScale) {
+		// A trace only records the scale it started with
+		if( recorder.Recording() && newScale != scale.load() ) {
+			stopTrace();
 		}
+		scale.store(newScale);
+	}
 
-		// Comvert to one volt per octave (12 semis in an octave)
-		std::vector<float> pitches;
-		for( unsigned int noteIndex = 0; noteIndex < numNotes; noteIndex++ ) {
-			pitches.push_back((float)(semis[noteIndex]) / 12.f);
-		}
-		return pitches;
+	void setBuiltInScale(int index) {
+		scaleSource = BUILT_IN_SCALE;
+		builtInScaleIndex = index;
+		useScale(&builtInScale(index));
 	}
 
-	// Progress is a float between zero (start of slide) and one (end of slide)
-	std::vector<float> interpolatePitches(float progress)
-	{
-		assert(toPitches.size() == fromPitches.size());
-
-		// Here is the profile that goes from 0 to 1 as the input parameter goes from 0 to 1
-		// (This is the "nth order algebraic sigmoid", used as a parametric smoothstep function, with n as squareness).
-		// n = 1 gives triangle (minimum squareness) and n=infinity would give a square step at x=0.5.
-
-		/* Old method, symmetric in time
-		float n = params[PROFILE_PARAM].getValue();
-		float x = progress;
-		// y = x^n/(x^n + (1-x)^n)
-		float xToN = pow(x,n);
-		float y = xToN / (xToN + pow(1.f - x,n));
-		float modifiedProgress = y;*/
-
-		// New code, with sharp start and soft end
-		float n = params[PROFILE_PARAM].getValue();
-		float x = (progress/2.f + 0.5);		// x now goes from 0.5 to 1.0
-		// y = x^n/(x^n + (1-x)^n)
-		float xToN = pow(x,n);
-		float y = xToN / (xToN + pow(1.f - x,n));
-		// y at this point goes from 0.5 to 1.0
-		// map y to (0.0 to 1.0)
-		y = (y-0.5f) * 2.f;
-		float modifiedProgress = y;
-
-		// Interpolate between fromPitches (progress==0) and toPitches (progress==1)
-		std::vector<float> pitches;
-		for( unsigned int i=0; i<fromPitches.size(); i++ ) {
-			float pitch = modifiedProgress * toPitches[i] + (1.f - modifiedProgress) * fromPitches[i];
-			pitches.push_back(pitch);
+	void setEqualDivision(int steps) {
+		scaleSource = EQUAL_DIVISION_SCALE;
+		equalDivisionSteps = steps;
+		useScale(keepScale("edo:" + std::to_string(steps), Scale::EqualDivision(steps)));
+	}
+
+	// Returns false, leaving the scale as it was, if text isn't a usable Scala scale
+	bool setScala(const std::string &text, std::string &error) {
+		std::unique_ptr<Scale> newScale = Scale::FromScala(text, error);
+		if( !newScale ) {
+			return false;
 		}
-		return pitches;
+		scaleSource = SCALA_SCALE;
+		scalaText = text;
+		useScale(keepScale("scala:" + text, std::move(newScale)));
+		return true;
 	}
 
-	// Output the polyphonic pitches
-	void playChord(std::vector<float> pitches)
-	{
-		outputs[VOCT_OUTPUT].setChannels(pitches.size());
-		for( unsigned int i=0; i<pitches.size(); i++ ) {
-			outputs[VOCT_OUTPUT].setVoltage(pitches[i], i);
+	void loadScalaFile() {
+		osdialog_filters* filters = osdialog_filters_parse("Scala scale (.scl):scl");
+		char* path = osdialog_file(OSDIALOG_OPEN, NULL, NULL, filters);
+		osdialog_filters_free(filters);
+		if( !path ) {
+			return;
+		}
+		std::ifstream file(path);
+		std::free(path);
+		std::stringstream text;
+		text << file.rdbuf();
+		std::string error;
+		if( !setScala(text.str(), error) ) {
+			osdialog_message(OSDIALOG_WARNING, OSDIALOG_OK, error.c_str());
 		}
 	}
 
-	void process(const ProcessArgs& args) override {
-		// First we check that the number of notes hasn't changed. Otherwise a mixture
-		// of sizes for fromPitches and toPitches could be disastrous!
-		int numNotes = (int)(params[CHORD_PARAM].getValue());
-		bool numNotesChanged = (numNotes != prevNumNotes);
-		prevNumNotes = numNotes;
-
-		// Is the current keypress pitch supported in the current key signature / mode?
-		bool invalidPress = false;
-		int note = notePressed(invalidPress);
-		if( !invalidPress ) {
-			lastValidNotePressed = note;
-			gateSuppressed = false;
+	json_t* dataToJson() override {
+		json_t* rootJ = json_object();
+		json_object_set_new(rootJ, "scaleSource", json_integer(scaleSource));
+		json_object_set_new(rootJ, "builtInScale", json_integer(builtInScaleIndex));
+		json_object_set_new(rootJ, "equalDivisionSteps", json_integer(equalDivisionSteps));
+		if( scaleSource == SCALA_SCALE ) {
+			json_object_set_new(rootJ, "scalaText", json_string(scalaText.c_str()));
 		}
-		std::vector<float> pitches = constructChord(lastValidNotePressed);
-
-		// Has the input gate been triggered this sample?
-		float gateV = inputs[GATE_INPUT].getVoltage();
-		auto tc = trigger.processEvent(gateV, 0.1, 1.0);
-		bool gateOn = (tc==dsp::SchmittTrigger::TRIGGERED);	// The gate has gone from "unpressed" to "pressed"
-		bool pitchChange = false;
-		if( invalidPress ) {
-			// The user pressed a key that's not in this key signature / mode. Act like it didn't happen
-			if( gateOn ) {
-				// It was a new keypress. Get rid of it altogether
-				gateOn = false;
-				// And supress the output gates for a while
-				gateSuppressed = true;
-			} else {
-				// It was a rollover to an invalid key
-				// gateOn is already false
-				// Leave gateV as it is, because it still relates to the key being rolled from
-			}
+		json_object_set_new(rootJ, "controlInterval", json_integer(controls.Interval()));
+		return rootJ;
+	}
+
+	void dataFromJson(json_t* rootJ) override {
+		json_t* sourceJ = json_object_get(rootJ, "scaleSource");
+		json_t* builtInJ = json_object_get(rootJ, "builtInScale");
+		json_t* stepsJ = json_object_get(rootJ, "equalDivisionSteps");
+		json_t* scalaJ = json_object_get(rootJ, "scalaText");
+		json_t* intervalJ = json_object_get(rootJ, "controlInterval");
+		controls.SetInterval(intervalJ ? (int)json_integer_value(intervalJ) : defaultControlInterval);
+		const char* savedScalaText = scalaJ ? json_string_value(scalaJ) : NULL;
+		int source = sourceJ ? (int)json_integer_value(sourceJ) : BUILT_IN_SCALE;
+		int builtIn = builtInJ ? (int)json_integer_value(builtInJ) : DIATONIC_SCALE;
+		int steps = stepsJ ? (int)json_integer_value(stepsJ) : 12;
+		std::string error;
+		if( source == EQUAL_DIVISION_SCALE && steps >= 1 && steps <= maxScaleSteps ) {
+			setEqualDivision(steps);
+		} else if( source == SCALA_SCALE && savedScalaText && setScala(savedScalaText, error) ) {
+			// Done
 		} else {
-			// Has the pitch changed more than 0.5 semitones this sample?
-			float pitchV = inputs[VOCT_INPUT].getVoltage();
-			pitchChange = abs(pitchV - prevPitch) > 1.f / 12.f / 2.f;
-			prevPitch = pitchV;
+			if( source == SCALA_SCALE ) {
+				WARN("ChordRollover: Can't use the saved Scala scale (%s)", error.c_str());
+			}
+			setBuiltInScale(builtIn >= 0 && builtIn < NUM_BUILT_IN_SCALES ? builtIn : DIATONIC_SCALE);
 		}
+	}
 
-		// Has the pitch changed without a gate trigger?
-		// (and we don't want to rollover if the number of notes has changed)
-		bool rollover = pitchChange && (!gateOn) && (!numNotesChanged);
+	// The GlideCurve chosen in the context menu
+	int glideCurve() {
+		return (int)params[CURVE_PARAM].getValue();
+	}
+
+	// The StrumMode chosen in the context menu
+	int strumMode() {
+		return (int)params[STRUM_PARAM].getValue();
+	}
 
-		// The polyphonic gate outputs are just copies of the input gate (unless suppressed by an out-of-key press)
-		if( gateSuppressed ) {
-			gateV = 0.f;
+	// Describes the scale in use for a trace: "builtin:" and the BuiltInScale, "edo:" and the steps
+	// per octave, or "scala:" and the text of the Scala file
+	std::string scaleSpec() {
+		switch( scaleSource ) {
+			case EQUAL_DIVISION_SCALE:
+				return "edo:" + std::to_string(equalDivisionSteps);
+			case SCALA_SCALE:
+				return "scala:" + scalaText;
+			default:
+				return "builtin:" + std::to_string(builtInScaleIndex);
 		}
-		outputs[GATE_OUTPUT].setChannels(numNotes);
-		for( int i=0; i<numNotes; i++ ) {
-			outputs[GATE_OUTPUT].setVoltage(gateV, i);
+	}
+
+	// Starts recording a trace to the Rack user folder, returning the file's path (or "" if it can't be written)
+	std::string startTrace() {
+		std::string directory = asset::user("ChordRollover");
+		system::createDirectories(directory);
+		std::string path = system::join(directory, string::f("trace-%lld-%lld.crtrace", (long long)id, (long long)system::getUnixTime()));
+		if( !recorder.Start(path, scaleSpec()) ) {
+			WARN("ChordRollover: Can't write a trace to %s", path.c_str());
+			return "";
 		}
+		INFO("ChordRollover: Recording a trace to %s", path.c_str());
+		return path;
+	}
 
-		if( (gateOn) || numNotesChanged ) {
-			// For a gateOn trigger, we are starting a chord
-			// We also do this when the user moves the "number of notes" knob
-			// (in that case, the "new" chord will only sound if the gate input is high, as this is copied to output gates)
-			fromPitches = pitches;
-			playChord(fromPitches);
-			timerTarget = 0;		// Indicate "no current slide"
-			lights[ROLLOVER_LIGHT].setBrightness(0.f);
-		} else if ( rollover ) {
-			// User has "rolled over" from one key to another, initiating a portamento glide
-
-			// Where do we want to get to?
-			auto chord = pitches;
-
-			// Where are we now?
-			bool abortedPreviousGlide = false;
-			if( timerTarget > 0 && timerSamples <= timerTarget ) {
-				// We WERE in the middle of a slide already.
-				// Start the new slide from wherever we'd got to so far.
-				float progress = ((float)(timerSamples)) / timerTarget;
-				fromPitches = interpolatePitches(progress);
-				std::sort(fromPitches.begin(), fromPitches.end());	// Seems sensible in the face of a slight bug
-				abortedPreviousGlide = true;
-			} else {
-				// We're sliding from a previously steady chord
-				// fromPitches is already set
-			}
+	void stopTrace() {
+		recorder.Stop();
+		INFO("ChordRollover: Trace stopped after %llu samples (%llu dropped)",
+			(unsigned long long)recorder.Stats().framesWritten.Get(), (unsigned long long)recorder.Stats().framesDropped.Get());
+	}
+
+	ProfileReport profileReport() {
+		return ProfileReport(processStats, engine.stats, engine.JumbleStatistics());
+	}
 
-			// Jumble notes in chord according to: jumble amount, where we are now, and where we want to get to
-			float jumbleAmount = params[JUMBLE_PARAM].getValue();
-			toPitches = jumbleChord(chord, fromPitches, jumbleAmount);
+	// Writes the profiling counters to the Rack user folder, returning the file's path
+	std::string exportProfile() {
+		ProfileReport report = profileReport();
+		json_t* rootJ = json_object();
+		json_object_set_new(rootJ, "moduleId", json_integer(id));
+		json_object_set_new(rootJ, "samples", json_integer(report.samples));
+		json_object_set_new(rootJ, "avgNsPerSample", json_real(report.avgNsPerSample));
+		json_object_set_new(rootJ, "maxNsPerSample", json_integer(report.maxNsPerSample));
+		json_object_set_new(rootJ, "rollovers", json_integer(report.rollovers));
+		json_object_set_new(rootJ, "rolloversPerSecond", json_real(report.rolloversPerSecond));
+		json_object_set_new(rootJ, "jumbleCalls", json_integer(report.jumbleCalls));
+		json_object_set_new(rootJ, "worstJumbleNs", json_integer(report.worstJumbleNs));
+		json_object_set_new(rootJ, "glideAborts", json_integer(report.glideAborts));
+		json_object_set_new(rootJ, "outOfKeySuppressions", json_integer(report.outOfKeySuppressions));
+
+		std::string directory = asset::user("ChordRollover");
+		system::createDirectories(directory);
+		std::string path = system::join(directory, string::f("profile-%lld.json", (long long)id));
+		json_dump_file(rootJ, path.c_str(), JSON_INDENT(2));
+		json_decref(rootJ);
+		INFO("ChordRollover: Profile exported to %s", path.c_str());
+		return path;
+	}
 
-			// Calculate timerTarget based on glide time setting knob
-			float glidePeriodSeconds = params[TIME_PARAM].getValue();
-			if( abortedPreviousGlide ) {
-				// If we started this glide from within a previous glide, we spend half as long on the new glide,
-				glidePeriodSeconds = glidePeriodSeconds / 2.f;
+	void process(const ProcessArgs& args) override {
+		// Counts the sample, and times one sample in every ProcessStats::timingInterval
+		ProcessTimer timer(processStats, args.sampleTime);
+
+		// In ALLOC_COUNTER builds this asserts that nothing below touches the heap
+		AssertNoAllocations noAllocations;
+
+		// The knobs and CVs are only read at the control rate, and the settings only remade when they change
+		bool settingsChanged = false;
+		if( controls.Due() ) {
+			float knobs[PARAMS_LEN];
+			for( int param = 0; param < PARAMS_LEN; param++ ) {
+				knobs[param] = params[param].getValue();
 			}
-			float sampleTimeSeconds = args.sampleTime;
-			timerTarget = (int)(glidePeriodSeconds / sampleTimeSeconds);	// When the end of glide will be
-
-			timerSamples = 0;	// Start of glide
+			float cvs[numControlInputs];
+			for( int input = 0; input < numControlInputs; input++ ) {
+				cvs[input] = inputs[KEYSIG_CV_INPUT + input].getVoltage();
+			}
+			if( controls.Update(knobs, cvs) ) {
+				settings = ChordEngineSettings::FromParams(scale.load(), controls.Values());
+				settingsChanged = true;
+			}
+		}
+		const Scale *currentScale = scale.load();
+		settingsChanged = settingsChanged || currentScale != settings.scale;
+		settings.scale = currentScale;
+
+		// A voice for each pitch channel. A mono gate is shared by all the voices.
+		int numVoices = std::max(inputs[VOCT_INPUT].getChannels(), 1);
+		float gates[PORT_MAX_CHANNELS];
+		for( int channel = 0; channel < numVoices; channel += 4 ) {
+			inputs[GATE_INPUT].getPolyVoltageSimd<simd::float_4>(channel).store(gates + channel);
 		}
 
-		if( timerTarget==0 ) {
-			// No current glide
-			lights[ROLLOVER_LIGHT].setBrightness(0.f);
-		} else if( timerSamples < timerTarget ) {
-			// Mid glide
-			timerSamples++;
-			float progress = ((float)(timerSamples)) / timerTarget;
-			std::vector<float> interPitches = interpolatePitches(progress);
-			playChord(interPitches);
-			// Light up the "Rollover" LED in a kinda linear way based on progress instead of a fixed length pulse
-			lights[ROLLOVER_LIGHT].setBrightness(1.f/3.f + 2.f * (1.f - progress)/3.f);
-		} else if( timerSamples == timerTarget ) {
-			// End point of glide. From now, act like this "always was" a flat unglided chord
-			fromPitches = toPitches;
-			std::sort(fromPitches.begin(), fromPitches.end());	// Seems sensible in the face of a slight bug
-			timerTarget = 0;
+		const float* voct = inputs[VOCT_INPUT].getVoltages();
+		engine.Process(settings, voct, gates, numVoices, args.sampleTime);
+
+		// Output voltages are held between samples, so they only need writing when they change
+		if( engine.pitchOutputsChanged ) {
+			outputs[VOCT_OUTPUT].setChannels(engine.outputChannels);
+			for( int channel = 0; channel < engine.outputChannels; channel += 4 ) {
+				outputs[VOCT_OUTPUT].setVoltageSimd(simd::float_4::load(engine.pitchOutputs + channel), channel);
+			}
+		}
+		if( engine.gateOutputsChanged ) {
+			outputs[GATE_OUTPUT].setChannels(engine.outputChannels);
+			for( int channel = 0; channel < engine.outputChannels; channel += 4 ) {
+				outputs[GATE_OUTPUT].setVoltageSimd(simd::float_4::load(engine.gateOutputs + channel), channel);
+			}
+		}
+		lights[ROLLOVER_LIGHT].setBrightness(engine.rolloverBrightness);
+
+		// Tell any companion modules alongside about the chords. The message written here is read by them
+		// on the next sample. It only needs writing when the chords or the settings change, and then on
+		// the sample after too, so that both messages of the pair are up to date and the flips can stop.
+		// (Until there's a neighbour, the count waits, so that one that turns up is told straight away.)
+		if( settingsChanged || engine.pitchOutputsChanged || engine.gateOutputsChanged ) {
+			expanderPublishes = 2;
+		}
+		if( expanderPublishes > 0 && (leftExpander.module || rightExpander.module) ) {
+			engine.Publish(*(ChordExpanderMessage*)leftExpander.producerMessage);
+			leftExpander.requestMessageFlip();
+			rightExpander.requestMessageFlip();
+			expanderPublishes--;
 		}
 
+		// Hand the sample to the trace writer, if a trace is being recorded
+		if( TraceFrame* frame = recorder.BeginFrame() ) {
+			frame->sampleTime = args.sampleTime;
+			std::copy(controls.Values(), controls.Values() + PARAMS_LEN, frame->params);
+			frame->numVoices = numVoices;
+			std::copy(voct, voct + numVoices, frame->voct);
+			std::copy(gates, gates + numVoices, frame->gate);
+			frame->outputChannels = engine.outputChannels;
+			std::copy(engine.pitchOutputs, engine.pitchOutputs + engine.outputChannels, frame->pitchOutputs);
+			std::copy(engine.gateOutputs, engine.gateOutputs + engine.outputChannels, frame->gateOutputs);
+			recorder.EndFrame();
+		}
 	}
 };
 
@@ -546,12 +391,19 @@ struct ChordRolloverWidget : ModuleWidget {
 		addChild(createWidget<ScrewSilver>(Vec(RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
 		addChild(createWidget<ScrewSilver>(Vec(box.size.x - 2 * RACK_GRID_WIDTH, RACK_GRID_HEIGHT - RACK_GRID_WIDTH)));
 
-		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(col1, 25)), module, ChordRollover::KEYSIG_PARAM));
-		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(col2, 25)), module, ChordRollover::MODE_PARAM));
-		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(col1, 50)), module, ChordRollover::CHORD_PARAM));
-		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(col2, 50)), module, ChordRollover::JUMBLE_PARAM));
-		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(col1, 75)), module, ChordRollover::PROFILE_PARAM));
-		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(col2, 75)), module, ChordRollover::TIME_PARAM));
+		// Each knob has its CV input below it
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(col1, 24)), module, ChordRollover::KEYSIG_PARAM));
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(col2, 24)), module, ChordRollover::MODE_PARAM));
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(col1, 46)), module, ChordRollover::CHORD_PARAM));
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(col2, 46)), module, ChordRollover::JUMBLE_PARAM));
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(col1, 68)), module, ChordRollover::PROFILE_PARAM));
+		addParam(createParamCentered<RoundBlackKnob>(mm2px(Vec(col2, 68)), module, ChordRollover::TIME_PARAM));
+		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(col1, 34)), module, ChordRollover::KEYSIG_CV_INPUT));
+		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(col2, 34)), module, ChordRollover::MODE_CV_INPUT));
+		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(col1, 56)), module, ChordRollover::CHORD_CV_INPUT));
+		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(col2, 56)), module, ChordRollover::JUMBLE_CV_INPUT));
+		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(col1, 78)), module, ChordRollover::PROFILE_CV_INPUT));
+		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(col2, 78)), module, ChordRollover::TIME_CV_INPUT));
 
 		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(7, 97)), module, ChordRollover::VOCT_INPUT));
 		addInput(createInputCentered<PJ301MPort>(mm2px(Vec(width - 7, 97)), module, ChordRollover::GATE_INPUT));
@@ -564,6 +416,94 @@ struct ChordRolloverWidget : ModuleWidget {
 		// mm2px(Vec(10.0, 10.0))
 		addChild(createWidget<Widget>(mm2px(Vec(2.684, 81.945))));
 	}
+
+	static std::string controlIntervalName(int interval) {
+		return interval == 1 ? "Every sample" : string::f("Every %d samples", interval);
+	}
+
+	void appendContextMenu(Menu* menu) override {
+		ChordRollover* module = getModule<ChordRollover>();
+
+		// Modes rotate the scale, so they are only the named modes for the diatonic scale
+		menu->addChild(new MenuSeparator);
+		menu->addChild(createSubmenuItem("Scale", module->scale.load()->Name(), [=](Menu* menu) {
+			for( int index = 0; index < NUM_BUILT_IN_SCALES; index++ ) {
+				menu->addChild(createCheckMenuItem(builtInScale(index).Name(), "",
+					[=]() {return module->scaleSource == ChordRollover::BUILT_IN_SCALE && module->builtInScaleIndex == index;},
+					[=]() {module->setBuiltInScale(index);}));
+			}
+			menu->addChild(createSubmenuItem("Equal division of the octave", "", [=](Menu* menu) {
+				static const int equalDivisions[] = {5, 7, 10, 12, 15, 17, 19, 22, 24, 31, 41, 53, 72};
+				for( int steps : equalDivisions ) {
+					menu->addChild(createCheckMenuItem(string::f("%d-EDO", steps), "",
+						[=]() {return module->scaleSource == ChordRollover::EQUAL_DIVISION_SCALE && module->equalDivisionSteps == steps;},
+						[=]() {module->setEqualDivision(steps);}));
+				}
+			}));
+			menu->addChild(createMenuItem("Load Scala (.scl) file...", "", [=]() {
+				module->loadScalaFile();
+			}));
+		}));
+
+		// The glide profile knob bends whichever curve is chosen here
+		menu->addChild(createSubmenuItem("Glide curve", glideCurveName(module->glideCurve()), [=](Menu* menu) {
+			for( int curve = 0; curve < NUM_GLIDE_CURVES; curve++ ) {
+				menu->addChild(createCheckMenuItem(glideCurveName(curve), "",
+					[=]() {return module->glideCurve() == curve;},
+					[=]() {module->params[ChordRollover::CURVE_PARAM].setValue((float)curve);}));
+			}
+		}));
+
+		// A strum staggers the notes of each glide over some of the glide time
+		menu->addChild(createSubmenuItem("Strum", strumModeName(module->strumMode()), [=](Menu* menu) {
+			for( int strum = 0; strum < NUM_STRUM_MODES; strum++ ) {
+				menu->addChild(createCheckMenuItem(strumModeName(strum), "",
+					[=]() {return module->strumMode() == strum;},
+					[=]() {module->params[ChordRollover::STRUM_PARAM].setValue((float)strum);}));
+			}
+			ui::Slider* spread = new ui::Slider;
+			spread->quantity = module->paramQuantities[ChordRollover::SPREAD_PARAM];
+			spread->box.size.x = 200.f;
+			menu->addChild(spread);
+		}));
+
+		// How often the knobs and CVs are read. Faster follows audio rate modulation more closely, at some cost.
+		menu->addChild(createSubmenuItem("CV control rate", controlIntervalName(module->controls.Interval()), [=](Menu* menu) {
+			static const int intervals[] = {1, 4, 16, 64};
+			for( int interval : intervals ) {
+				menu->addChild(createCheckMenuItem(controlIntervalName(interval), "",
+					[=]() {return module->controls.Interval() == interval;},
+					[=]() {module->controls.SetInterval(interval);}));
+			}
+		}));
+
+		// The profiling counters, as they were when the menu was opened
+		ProfileReport report = module->profileReport();
+		menu->addChild(new MenuSeparator);
+		menu->addChild(createMenuLabel("Profiling"));
+		menu->addChild(createMenuLabel(string::f("Process: %.0f ns avg, %llu ns max (1 in %d samples timed)",
+			report.avgNsPerSample, (unsigned long long)report.maxNsPerSample, ProcessStats::timingInterval)));
+		menu->addChild(createMenuLabel(string::f("Rollovers: %llu (%.2f per second)", (unsigned long long)report.rollovers, report.rolloversPerSecond)));
+		menu->addChild(createMenuLabel(string::f("Jumbles: %llu, worst %.3f ms", (unsigned long long)report.jumbleCalls, report.worstJumbleNs * 1e-6)));
+		menu->addChild(createMenuLabel(string::f("Glide aborts: %llu", (unsigned long long)report.glideAborts)));
+		menu->addChild(createMenuLabel(string::f("Out of key suppressions: %llu", (unsigned long long)report.outOfKeySuppressions)));
+		menu->addChild(createMenuItem("Export profile as JSON", "", [=]() {
+			module->exportProfile();
+		}));
+
+		// Traces of exactly what the module was given, for reproducing odd glides
+		menu->addChild(new MenuSeparator);
+		if( module->recorder.Recording() ) {
+			const TraceStats &stats = module->recorder.Stats();
+			menu->addChild(createMenuItem("Stop recording trace",
+				string::f("%llu samples, %llu dropped", (unsigned long long)stats.framesWritten.Get(), (unsigned long long)stats.framesDropped.Get()),
+				[=]() {module->stopTrace();}));
+		} else {
+			menu->addChild(createMenuItem("Start recording trace", "", [=]() {
+				module->startTrace();
+			}));
+		}
+	}
 };
 
 Model* modelChordRollover = createModel<ChordRollover, ChordRolloverWidget>("ChordRollover");
\ No newline at end of file
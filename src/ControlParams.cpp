@@ -0,0 +1,50 @@
+#include "ControlParams.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+const ControlSpec &controlSpec(int param)
+{
+	static const ControlSpec specs[NUM_ENGINE_PARAMS] = {
+		{0.f, 11.f, 12.f, 0.f, true, true},					// KEYSIG: V/Oct, so a semitone per 1/12V
+		{0.f, 6.f, 1.f, 0.f, true, false},					// MODE: a mode per volt
+		{1.f, 16.f, 1.f, 0.f, true, false},					// CHORD: a note per volt
+		{0.001f, 5.f, 0.5f, 0.0005f, false, false},			// TIME: half a second per volt
+		{1.f, 10.f, 0.9f, 0.05f, false, false},				// PROFILE: 0V to 10V sweeps the range. Half a step of the baked glide curves.
+		{0.f, 1.f, 0.1f, 0.001f, false, false},				// JUMBLE: likewise
+		{0.f, NUM_GLIDE_CURVES - 1, 0.f, 0.f, true, false},	// CURVE, STRUM and SPREAD have no CV
+		{0.f, NUM_STRUM_MODES - 1, 0.f, 0.f, true, false},
+		{0.f, 1.f, 0.f, 0.f, false, false}
+	};
+	assert(param >= 0 && param < NUM_ENGINE_PARAMS);
+	return specs[param];
+}
+
+uint32_t ControlParams::Update(const float *knobs, const float *cvs)
+{
+	uint32_t changed = 0;
+	for( int param = 0; param < NUM_ENGINE_PARAMS; param++ ) {
+		const ControlSpec &spec = controlSpec(param);
+		float value = knobs[param];
+		if( param < numControlInputs ) {
+			value += cvs[param] * spec.perVolt;
+		}
+		if( spec.integer ) {
+			value = std::round(value);
+		}
+		if( spec.wraps ) {
+			float range = spec.maximum - spec.minimum + 1.f;
+			value = spec.minimum + (value - spec.minimum) - range * std::floor((value - spec.minimum) / range);
+		} else {
+			value = std::min(std::max(value, spec.minimum), spec.maximum);
+		}
+		// A move to either end of the range always counts, so that the ends can be reached
+		bool atEnd = (value == spec.minimum || value == spec.maximum);
+		if( !m_valid || (value != m_values[param] && (std::fabs(value - m_values[param]) > spec.threshold || atEnd)) ) {
+			m_values[param] = value;
+			changed |= 1u << param;
+		}
+	}
+	m_valid = true;
+	return changed;
+}
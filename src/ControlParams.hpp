@@ -0,0 +1,55 @@
+#pragma once
+
+// The knobs plus their CV inputs, read at a control rate rather than every sample. Audio rate
+// modulation would otherwise change the key, chord or jumble every sample, and the engine would
+// rebuild its chords and ask for a new jumble table every sample. Only changes bigger than each
+// param's threshold count, so that noise on a CV doesn't do the same at the control rate.
+// Like ChordCore, this doesn't depend on Rack.
+
+#include "ChordEngine.hpp"
+#include <cstdint>
+
+const int numControlInputs = JUMBLE_ENGINE_PARAM + 1;	// The knobs up to JUMBLE have CV inputs, in EngineParam order
+const int defaultControlInterval = 16;					// Samples between reads of the CVs (3kHz at 48kHz)
+
+// How a param's CV moves it from where its knob is, and its range
+struct ControlSpec
+{
+	float minimum;
+	float maximum;
+	float perVolt;		// How far one volt moves it
+	float threshold;	// Changes of this much or less are ignored
+	bool integer;		// Rounded to a whole number
+	bool wraps;			// Wraps around, rather than stopping at the ends of its range
+};
+
+const ControlSpec &controlSpec(int param);
+
+class ControlParams
+{
+	private:
+		float m_values[NUM_ENGINE_PARAMS];
+		bool m_valid;		// False until the first Update()
+		int m_interval;
+		int m_countdown;
+	public:
+		ControlParams() : m_valid(false), m_interval(defaultControlInterval), m_countdown(0) {}
+
+		int Interval() const {return m_interval;}
+		void SetInterval(int samples) {m_interval = samples < 1 ? 1 : samples;}
+
+		// Called every sample. True when it's time to Update().
+		bool Due()
+		{
+			if( --m_countdown > 0 ) {
+				return false;
+			}
+			m_countdown = m_interval;
+			return true;
+		}
+		// knobs has NUM_ENGINE_PARAMS values, and cvs numControlInputs voltages (0 for an unpatched
+		// input). Returns the params that have changed since the last Update(), as bits (1 << param).
+		uint32_t Update(const float *knobs, const float *cvs);
+		// Every param's value, in EngineParam order, as of the last Update()
+		const float *Values() const {return m_values;}
+};
@@ -0,0 +1,155 @@
+#include "DiagnosticLog.hpp"
+#include "ChordCore.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+void formatDiagnostic(const Diagnostic &diagnostic, char *message, size_t size)
+{
+	static const char *formats[NUM_DIAGNOSTIC_EVENTS] = {
+		"Bypassed the jumble for %.0f of %.0f rollovers, as jumbleAmount==0.0 and the chords are sorted",
+		"A rollover came before the jumble table for %.0f notes and jumble %.2f was ready, so it went to the sorted chord",
+		"A rollover from note %.0f to note %.0f was beyond the jumble table, so it went to the sorted chord"
+	};
+	assert(diagnostic.event >= 0 && diagnostic.event < NUM_DIAGNOSTIC_EVENTS);
+	int length = std::snprintf(message, size, "ChordRollover: ");
+	length += std::snprintf(message + length, size - std::min((size_t)length, size), formats[diagnostic.event], diagnostic.values[0], diagnostic.values[1]);
+	if( diagnostic.suppressed > 0 ) {
+		std::snprintf(message + length, size - std::min((size_t)length, size), " (%u more like it since the last message)", diagnostic.suppressed);
+	}
+}
+
+// The thread that writes every channel's diagnostics to chordCoreLog. It runs while there are any channels.
+class DiagnosticLogger
+{
+	private:
+		std::mutex m_lifetimeMutex;		// Held while channels register and unregister, which starts and stops the thread
+		std::mutex m_mutex;				// Guards the rest
+		std::condition_variable m_wake;
+		std::vector<DiagnosticChannel*> m_channels;
+		bool m_quit;
+		std::thread m_thread;
+
+		static const int pollMs = 100;
+
+		static void drain(DiagnosticChannel &channel)
+		{
+			while( const Diagnostic *diagnostic = channel.m_ring.Front() ) {
+				char message[256];
+				formatDiagnostic(*diagnostic, message, sizeof(message));
+				chordCoreLog(message);
+				channel.m_ring.Pop();
+			}
+		}
+
+		void Run()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while( !m_quit ) {
+				for( DiagnosticChannel *channel : m_channels ) {
+					drain(*channel);
+				}
+				m_wake.wait_for(lock, std::chrono::milliseconds(pollMs));
+			}
+		}
+
+	public:
+		static DiagnosticLogger &Instance()
+		{
+			static DiagnosticLogger logger;
+			return logger;
+		}
+
+		DiagnosticLogger() : m_quit(false) {}
+		~DiagnosticLogger()
+		{
+			// Only if a channel outlived everything else
+			if( m_thread.joinable() ) {
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_quit = true;
+				}
+				m_wake.notify_one();
+				m_thread.join();
+			}
+		}
+
+		void Register(DiagnosticChannel *channel)
+		{
+			std::lock_guard<std::mutex> lifetimeLock(m_lifetimeMutex);
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_channels.push_back(channel);
+				m_quit = false;
+			}
+			if( !m_thread.joinable() ) {
+				m_thread = std::thread(&DiagnosticLogger::Run, this);
+			}
+		}
+
+		void Unregister(DiagnosticChannel *channel)
+		{
+			std::lock_guard<std::mutex> lifetimeLock(m_lifetimeMutex);
+			bool last;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				drain(*channel);
+				m_channels.erase(std::find(m_channels.begin(), m_channels.end(), channel));
+				last = m_channels.empty();
+				m_quit = last;
+			}
+			if( last ) {
+				m_wake.notify_one();
+				m_thread.join();
+			}
+		}
+};
+
+DiagnosticChannel::DiagnosticChannel(int minIntervalMs)
+: m_ring(ringSize)
+, m_minInterval(std::chrono::milliseconds(minIntervalMs))
+{
+	// So that the first of each event is sent
+	std::fill(m_lastSent, m_lastSent + NUM_DIAGNOSTIC_EVENTS, std::chrono::steady_clock::now() - m_minInterval);
+	std::fill(m_suppressed, m_suppressed + NUM_DIAGNOSTIC_EVENTS, 0);
+	DiagnosticLogger::Instance().Register(this);
+}
+
+DiagnosticChannel::~DiagnosticChannel()
+{
+	// The reporting thread has finished with the channel, so this thread can report for it
+	for( int event = 0; event < NUM_DIAGNOSTIC_EVENTS; event++ ) {
+		if( m_suppressed[event] > 0 ) {
+			Diagnostic *diagnostic = m_ring.BeginPush();
+			if( diagnostic ) {
+				*diagnostic = m_lastSuppressed[event];
+				diagnostic->suppressed = m_suppressed[event] - 1;
+				m_ring.EndPush();
+			}
+		}
+	}
+	DiagnosticLogger::Instance().Unregister(this);
+}
+
+void DiagnosticChannel::Post(DiagnosticEvent event, float value0, float value1)
+{
+	Diagnostic latest = {event, {value0, value1}, m_suppressed[event]};
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if( now - m_lastSent[event] < m_minInterval ) {
+		m_lastSuppressed[event] = latest;
+		m_suppressed[event]++;
+		return;
+	}
+	Diagnostic *diagnostic = m_ring.BeginPush();
+	if( !diagnostic ) {
+		m_dropped.Add(1);
+		return;
+	}
+	*diagnostic = latest;
+	m_ring.EndPush();
+	m_lastSent[event] = now;
+	m_suppressed[event] = 0;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+// Diagnostics from the audio thread and the transition table worker, which mustn't take the
+// logger's lock or format strings. A thread reports an event by pushing a few numbers into its
+// own DiagnosticChannel; one background thread, shared by every channel, formats them and passes
+// them to chordCoreLog.
+// Like ChordCore, this doesn't depend on Rack.
+
+#include "Profiling.hpp"
+#include "SpscRing.hpp"
+#include <chrono>
+
+// What can be reported. Each has a message in DiagnosticLog.cpp, formatted with the event's two values.
+enum DiagnosticEvent
+{
+	JUMBLE_BYPASSED_EVENT,			// (bypassed rollovers, rollovers) in a transition table with no jumble
+	TABLE_NOT_READY_EVENT,			// (notes, jumble amount) of a rollover that came before its transition table
+	ROLLOVER_OUT_OF_REACH_EVENT,	// (from note, to note) of a rollover too far for the transition table
+	NUM_DIAGNOSTIC_EVENTS
+};
+
+struct Diagnostic
+{
+	DiagnosticEvent event;
+	float values[2];
+	uint32_t suppressed;	// Events of this kind not sent since the last one, because of the rate limit
+};
+
+// Formats a diagnostic as a log message
+void formatDiagnostic(const Diagnostic &diagnostic, char *message, size_t size);
+
+// The reporting end of the log, for one thread. Post() never blocks or touches the heap: the
+// event goes into a preallocated ring, or is dropped (and counted) if the ring is full.
+// Each kind of event is sent at most once per minIntervalMs; the ones in between are only counted,
+// and the count goes with the next one that is sent (or with a final report when the channel is destroyed).
+class DiagnosticChannel
+{
+	private:
+		static const size_t ringSize = 64;
+
+		SpscRing<Diagnostic> m_ring;
+		std::chrono::steady_clock::duration m_minInterval;
+		std::chrono::steady_clock::time_point m_lastSent[NUM_DIAGNOSTIC_EVENTS];	// Only used by the reporting thread
+		uint32_t m_suppressed[NUM_DIAGNOSTIC_EVENTS];								// Likewise
+		Diagnostic m_lastSuppressed[NUM_DIAGNOSTIC_EVENTS];							// Likewise
+		SharedStat<uint64_t> m_dropped;
+
+		friend class DiagnosticLogger;
+	public:
+		// Registers with the shared log thread (starting it if this is the only channel),
+		// so mustn't be called on the audio thread
+		explicit DiagnosticChannel(int minIntervalMs = 1000);
+		// Sends the counts of suppressed events, and waits for everything to be written
+		~DiagnosticChannel();
+		// Called by the reporting thread
+		void Post(DiagnosticEvent event, float value0 = 0.f, float value1 = 0.f);
+		// Diagnostics lost because the ring was full
+		uint64_t Dropped() const {return m_dropped.Get();}
+};
@@ -42,37 +42,37 @@ with open('res\\GeneratedPanel.svg', 'w') as file:
     file.write('       </text>\n')
     file.write('    <text\n')
     file.write('       x="8"\n')
-    file.write('       y="19"\n')
+    file.write('       y="18"\n')
     file.write('       style="font-size:0.8mm;text-anchor:middle;fill:#000000">\n')
     file.write('       KEY\n')
     file.write('       </text>\n')
     file.write('    <text\n')
     file.write('       x="23"\n')
-    file.write('       y="19"\n')
+    file.write('       y="18"\n')
     file.write('       style="font-size:0.8mm;text-anchor:middle;fill:#000000">\n')
     file.write('       MODE\n')
     file.write('       </text>\n')
     file.write('    <text\n')
     file.write('       x="8"\n')
-    file.write('       y="44"\n')
+    file.write('       y="40"\n')
     file.write('       style="font-size:0.8mm;text-anchor:middle;fill:#000000">\n')
     file.write('       NOTES\n')
     file.write('       </text>\n')
     file.write('    <text\n')
     file.write('       x="23"\n')
-    file.write('       y="44"\n')
+    file.write('       y="40"\n')
     file.write('       style="font-size:0.8mm;text-anchor:middle;fill:#000000">\n')
     file.write('       JUMBLE\n')
     file.write('       </text>\n')
     file.write('    <text\n')
     file.write('       x="8"\n')
-    file.write('       y="69"\n')
+    file.write('       y="62"\n')
     file.write('       style="font-size:0.8mm;text-anchor:middle;fill:#000000">\n')
     file.write('       PROFILE\n')
     file.write('       </text>\n')
     file.write('    <text\n')
     file.write('       x="23"\n')
-    file.write('       y="69"\n')
+    file.write('       y="62"\n')
     file.write('       style="font-size:0.8mm;text-anchor:middle;fill:#000000">\n')
     file.write('       TIME\n')
     file.write('       </text>\n')
@@ -0,0 +1,111 @@
+#include "GlideCurve.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+const char *glideCurveName(int curve)
+{
+	static const char *names[NUM_GLIDE_CURVES] = {"Sharp start sigmoid", "Exponential (RC)", "Linear", "Cosine", "Stepped"};
+	assert(curve >= 0 && curve < NUM_GLIDE_CURVES);
+	return names[curve];
+}
+
+float glideProfile(float progress, float squareness)
+{
+	// Here is the profile that goes from 0 to 1 as the input parameter goes from 0 to 1
+	// (This is the "nth order algebraic sigmoid", used as a parametric smoothstep function, with n as squareness).
+	// n = 1 gives triangle (minimum squareness) and n=infinity would give a square step at x=0.5.
+
+	/* Old method, symmetric in time
+	float n = squareness;
+	float x = progress;
+	// y = x^n/(x^n + (1-x)^n)
+	float xToN = pow(x,n);
+	float y = xToN / (xToN + pow(1.f - x,n));
+	float modifiedProgress = y;*/
+
+	// New code, with sharp start and soft end
+	float n = squareness;
+	float x = (progress/2.f + 0.5);		// x now goes from 0.5 to 1.0
+	// y = x^n/(x^n + (1-x)^n)
+	float xToN = pow(x,n);
+	float y = xToN / (xToN + pow(1.f - x,n));
+	// y at this point goes from 0.5 to 1.0
+	// map y to (0.0 to 1.0)
+	y = (y-0.5f) * 2.f;
+	return y;
+}
+
+float glideCurve(int curve, float progress, float profile)
+{
+	switch( curve ) {
+		case SIGMOID_GLIDE_CURVE:
+			return glideProfile(progress, profile);
+		case EXPONENTIAL_GLIDE_CURVE: {
+			// The charging curve of a capacitor, scaled so that it gets all the way there at the end
+			float rate = (profile - 1.f) * 2.5f;
+			if( rate < 1e-3f ) {
+				return progress;
+			}
+			return (1.f - std::exp(-rate * progress)) / (1.f - std::exp(-rate));
+		}
+		case LINEAR_GLIDE_CURVE:
+			return progress;
+		case COSINE_GLIDE_CURVE:
+			return 0.5f - 0.5f * std::cos(progress * (float)M_PI);
+		case STEPPED_GLIDE_CURVE: {
+			// Held for an equal time at each of steps + 1 levels, landing on the last one before the end
+			int steps = std::max(1, (int)std::round(profile));
+			return std::min((float)(int)(progress * (steps + 1)), (float)steps) / steps;
+		}
+	}
+	assert(false);
+	return progress;
+}
+
+float quantizeGlideProfile(float profile)
+{
+	return std::min(std::max(std::round(profile * glideProfileSteps), (float)glideProfileSteps), 10.f * glideProfileSteps) / glideProfileSteps;
+}
+
+// Every curve, baked for each quantized profile
+struct BakedGlideCurves
+{
+	static const int tableSize = GlideCurveTable::tableSegments + 2;
+	static const int numProfiles = 9 * glideProfileSteps + 1;
+
+	std::vector<float> values[NUM_GLIDE_CURVES];	// numProfiles tables, or one for a curve that ignores the profile
+
+	static bool UsesProfile(int curve)
+	{
+		return curve != LINEAR_GLIDE_CURVE && curve != COSINE_GLIDE_CURVE;
+	}
+
+	BakedGlideCurves()
+	{
+		for( int curve = 0; curve < NUM_GLIDE_CURVES; curve++ ) {
+			int profiles = UsesProfile(curve) ? numProfiles : 1;
+			values[curve].resize(profiles * tableSize);
+			for( int index = 0; index < profiles; index++ ) {
+				float profile = 1.f + (float)index / glideProfileSteps;
+				float *table = &values[curve][index * tableSize];
+				for( int i = 0; i <= GlideCurveTable::tableSegments; i++ ) {
+					table[i] = glideCurve(curve, (float)i / GlideCurveTable::tableSegments, profile);
+				}
+				table[GlideCurveTable::tableSegments + 1] = table[GlideCurveTable::tableSegments];
+			}
+		}
+	}
+};
+
+const float *GlideCurveTable::bakedGlideCurve(int curve, float profile)
+{
+	static const BakedGlideCurves baked;
+	assert(curve >= 0 && curve < NUM_GLIDE_CURVES);
+	int index = 0;
+	if( BakedGlideCurves::UsesProfile(curve) ) {
+		index = (int)std::round(quantizeGlideProfile(profile) * glideProfileSteps) - glideProfileSteps;
+	}
+	return &baked.values[curve][index * BakedGlideCurves::tableSize];
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+// The shapes that a glide can follow from one chord to the next. Each is a curve from
+// (0, 0) to (1, 1), bent by the glide profile knob, and is baked into a table so that the audio
+// thread only interpolates between table entries instead of evaluating the curve every sample.
+// Like ChordCore, this doesn't depend on Rack.
+
+// In the order of the module's glide curve param
+enum GlideCurve
+{
+	SIGMOID_GLIDE_CURVE,		// Sharp start, soft end. Profile 1 is linear; 10 is nearly a step at the start.
+	EXPONENTIAL_GLIDE_CURVE,	// Like an RC filter settling. Profile 1 is linear; 10 is 90% there a tenth of the way in.
+	LINEAR_GLIDE_CURVE,			// Ignores the profile
+	COSINE_GLIDE_CURVE,			// Soft start and end. Ignores the profile.
+	STEPPED_GLIDE_CURVE,		// Jumps in equal steps at equal intervals: one for profile 1, up to ten for profile 10
+	NUM_GLIDE_CURVES
+};
+
+const char *glideCurveName(int curve);
+
+// Progress is a float between zero (start of slide) and one (end of slide).
+// Returns the "modified progress", also from zero to one, which follows the glide profile.
+float glideProfile(float progress, float squareness);
+
+// Like glideProfile(), for any of the curves. This is what GlideCurveTable bakes.
+float glideCurve(int curve, float progress, float profile);
+
+const int glideProfileSteps = 10;	// The tables are baked for profiles this far apart (a tenth) from 1 to 10
+
+// The nearest profile that the tables are baked for
+float quantizeGlideProfile(float profile);
+
+// glideCurve() sampled at tableSegments + 1 evenly spaced points. Every curve is baked for every
+// quantized profile (or just once, if it ignores the profile) the first time a table is made,
+// which mustn't be on the audio thread. After that, moving the curve or profile knob, or sweeping
+// the profile with a CV, only picks another of the baked tables.
+class GlideCurveTable
+{
+	public:
+		static const int tableSegments = 256;
+
+		GlideCurveTable() : m_values(bakedGlideCurve(LINEAR_GLIDE_CURVE, 1.f)) {}
+		// Called by the audio thread every sample. Returns true if it picked a different table.
+		bool Update(int curve, float profile)
+		{
+			const float *values = bakedGlideCurve(curve, profile);
+			bool changed = values != m_values;
+			m_values = values;
+			return changed;
+		}
+		// progress must be from zero to one
+		float Lookup(float progress) const
+		{
+			float position = progress * tableSegments;
+			int index = (int)position;
+			float fraction = position - (float)index;
+			return m_values[index] + fraction * (m_values[index + 1] - m_values[index]);
+		}
+
+	private:
+		const float *m_values;		// tableSegments + 2 values. The last repeats the end point, so that Lookup(1) needn't check.
+
+		static const float *bakedGlideCurve(int curve, float profile);
+};
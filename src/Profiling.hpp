@@ -0,0 +1,110 @@
+#pragma once
+
+// Per-instance counters for the hot path, cheap enough to leave switched on. Each statistic has a
+// single writer (the audio thread or the transition table worker) and is read from the UI thread
+// for the context menu, so it is a relaxed atomic. On the writing side that costs no more than a
+// plain variable. Doesn't depend on Rack.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+template<typename T>
+class SharedStat
+{
+	private:
+		std::atomic<T> m_value;
+	public:
+		SharedStat() : m_value(0) {}
+		T Get() const {return m_value.load(std::memory_order_relaxed);}
+		void Set(T value) {m_value.store(value, std::memory_order_relaxed);}
+		// Only ever called by the one writing thread, so doesn't need an atomic read-modify-write
+		void Add(T value) {Set(Get() + value);}
+		void Max(T value) {if( value > Get() ) {Set(value);}}
+};
+
+// Written by the transition table worker
+struct JumbleStats
+{
+	SharedStat<uint64_t> calls;		// jumbleOrder() calls, which is where jumbleChord() spends its time
+	SharedStat<uint64_t> worstNs;	// The longest of them
+};
+
+// Written by the engine, on the audio thread
+struct EngineStats
+{
+	SharedStat<uint64_t> rollovers;
+	SharedStat<uint64_t> glideAborts;			// Rollovers that started part way through a glide
+	SharedStat<uint64_t> outOfKeySuppressions;	// Out of key keypresses whose gates were suppressed
+};
+
+// Written by the module's process(), on the audio thread
+struct ProcessStats
+{
+	static const int timingInterval = 16;	// Only one sample in this many is timed, to keep the clock reads cheap
+
+	SharedStat<uint64_t> samples;
+	SharedStat<double> audioSeconds;
+	SharedStat<uint64_t> timedSamples;
+	SharedStat<uint64_t> timedNs;
+	SharedStat<uint64_t> maxNs;
+};
+
+// Counts a sample for the lifetime of the object, timing it if it is one of the sampled ones
+class ProcessTimer
+{
+	private:
+		ProcessStats &m_stats;
+		bool m_timed;
+		std::chrono::steady_clock::time_point m_start;
+	public:
+		ProcessTimer(ProcessStats &stats, float sampleTime)
+		: m_stats(stats)
+		{
+			uint64_t samples = m_stats.samples.Get();
+			m_stats.samples.Set(samples + 1);
+			m_stats.audioSeconds.Add(sampleTime);
+			m_timed = (samples % ProcessStats::timingInterval == 0);
+			if( m_timed ) {
+				m_start = std::chrono::steady_clock::now();
+			}
+		}
+		~ProcessTimer()
+		{
+			if( m_timed ) {
+				uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+				m_stats.timedSamples.Add(1);
+				m_stats.timedNs.Add(ns);
+				m_stats.maxNs.Max(ns);
+			}
+		}
+};
+
+// A snapshot of all the statistics, with the rates worked out
+struct ProfileReport
+{
+	uint64_t samples;
+	double avgNsPerSample;
+	uint64_t maxNsPerSample;
+	uint64_t rollovers;
+	double rolloversPerSecond;
+	uint64_t jumbleCalls;
+	uint64_t worstJumbleNs;
+	uint64_t glideAborts;
+	uint64_t outOfKeySuppressions;
+
+	ProfileReport(const ProcessStats &process, const EngineStats &engine, const JumbleStats &jumble)
+	{
+		samples = process.samples.Get();
+		uint64_t timedSamples = process.timedSamples.Get();
+		avgNsPerSample = timedSamples ? (double)process.timedNs.Get() / timedSamples : 0.0;
+		maxNsPerSample = process.maxNs.Get();
+		rollovers = engine.rollovers.Get();
+		double audioSeconds = process.audioSeconds.Get();
+		rolloversPerSecond = audioSeconds > 0.0 ? rollovers / audioSeconds : 0.0;
+		jumbleCalls = jumble.calls.Get();
+		worstJumbleNs = jumble.worstNs.Get();
+		glideAborts = engine.glideAborts.Get();
+		outOfKeySuppressions = engine.outOfKeySuppressions.Get();
+	}
+};
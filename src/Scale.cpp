@@ -0,0 +1,255 @@
+#include "Scale.hpp"
+#include <cstdlib>
+#include <sstream>
+
+static std::atomic<int> nextScaleId(1);
+
+// Where the third and fifth of a chord go in scales of more than seven notes, as fractions of the period
+static const float chordThirdPeriods = 0.3219f;		// log2(5/4)
+static const float chordFifthPeriods = 0.5850f;		// log2(3/2)
+
+Scale::Scale(const std::string &name, int stepsPerOctave, float periodVolts, const float *stepVolts, const bool *stepInScale)
+: m_name(name)
+, m_id((uint16_t)nextScaleId.fetch_add(1))
+, m_stepsPerOctave(stepsPerOctave)
+, m_notesPerOctave(0)
+, m_periodVolts(periodVolts)
+, m_equal(false)
+, m_changeThreshold(0.f)
+{
+	assert(stepsPerOctave >= 1 && stepsPerOctave <= maxScaleSteps);
+	assert(stepVolts[0] == 0.f && stepInScale[0]);
+
+	int noteSteps[maxScaleSteps];
+	float smallestStep = periodVolts - stepVolts[stepsPerOctave - 1];
+	for( int step = 0; step < stepsPerOctave; step++ ) {
+		if( stepInScale[step] ) {
+			noteSteps[m_notesPerOctave++] = step;
+		}
+		if( step > 0 ) {
+			smallestStep = std::min(smallestStep, stepVolts[step] - stepVolts[step - 1]);
+		}
+	}
+	m_changeThreshold = smallestStep / 2.f;
+
+	for( int key = 0; key < numKeys; key++ ) {
+		m_keyStep[key] = (int)std::round(key * stepsPerOctave / 12.f);
+	}
+
+	for( int mode = 0; mode < numModes; mode++ ) {
+		// Rotate the steps, so that the mode's tonic is step 0
+		int tonicStep = noteSteps[mode % m_notesPerOctave];
+		int note = -1;
+		for( int step = 0; step < stepsPerOctave; step++ ) {
+			int unrotated = tonicStep + step;
+			bool wrapped = unrotated >= stepsPerOctave;
+			unrotated = unrotated % stepsPerOctave;
+			m_stepVolts[mode][step] = stepVolts[unrotated] - stepVolts[tonicStep] + (wrapped ? periodVolts : 0.f);
+			m_outOfKey[mode][step] = !stepInScale[unrotated];
+			if( stepInScale[unrotated] ) {
+				note++;
+				m_stepOfNote[mode][note] = step;
+			}
+			m_noteOfStep[mode][step] = note;
+		}
+
+		// Each step gets the pitches nearer to it than to its neighbours
+		m_lowerBoundary[mode][0] = (m_stepVolts[mode][stepsPerOctave - 1] - periodVolts) / 2.f;
+		for( int step = 1; step < stepsPerOctave; step++ ) {
+			m_lowerBoundary[mode][step] = (m_stepVolts[mode][step - 1] + m_stepVolts[mode][step]) / 2.f;
+		}
+		m_lowerBoundary[mode][stepsPerOctave] = (m_stepVolts[mode][stepsPerOctave - 1] + periodVolts) / 2.f;
+		int step = 0;
+		for( int bin = 0; bin < quantizeBins; bin++ ) {
+			float binVolts = bin * periodVolts / quantizeBins;
+			while( step < stepsPerOctave && binVolts >= m_lowerBoundary[mode][step + 1] ) {
+				step++;
+			}
+			m_binStep[mode][bin] = (uint8_t)step;
+		}
+
+		// The chord on each note (see ChordDegree())
+		for( int root = 0; root < m_notesPerOctave; root++ ) {
+			uint8_t *chordNotes = m_chordNotes[mode][root];
+			chordNotes[0] = 0;
+			chordNotes[1] = 2;
+			chordNotes[2] = 4;
+			if( m_notesPerOctave <= 7 ) {
+				continue;
+			}
+			auto interval = [&](int notesAbove) {
+				int note = root + notesAbove;
+				float volts = m_stepVolts[mode][m_stepOfNote[mode][note % m_notesPerOctave]] + (note >= m_notesPerOctave ? periodVolts : 0.f);
+				return volts - m_stepVolts[mode][m_stepOfNote[mode][root]];
+			};
+			auto nearest = [&](float fraction, int lowest, int highest) {
+				int best = lowest;
+				for( int notesAbove = lowest + 1; notesAbove <= highest; notesAbove++ ) {
+					if( std::fabs(interval(notesAbove) - fraction * periodVolts) < std::fabs(interval(best) - fraction * periodVolts) ) {
+						best = notesAbove;
+					}
+				}
+				return best;
+			};
+			// Kept in order, and below the next octave's root
+			chordNotes[1] = (uint8_t)nearest(chordThirdPeriods, 1, m_notesPerOctave - 2);
+			chordNotes[2] = (uint8_t)nearest(chordFifthPeriods, chordNotes[1] + 1, m_notesPerOctave - 1);
+		}
+	}
+}
+
+std::unique_ptr<Scale> Scale::Equal(const std::string &name, int stepsPerOctave, const int *intervals, int numIntervals)
+{
+	float stepVolts[maxScaleSteps];
+	bool stepInScale[maxScaleSteps];
+	for( int step = 0; step < stepsPerOctave; step++ ) {
+		stepVolts[step] = (float)step / stepsPerOctave;
+		stepInScale[step] = false;
+	}
+	int step = 0;
+	for( int i = 0; i < numIntervals; i++ ) {
+		stepInScale[step] = true;
+		step += intervals[i];
+	}
+	assert(step == stepsPerOctave);
+	std::unique_ptr<Scale> scale(new Scale(name, stepsPerOctave, 1.f, stepVolts, stepInScale));
+	scale->m_equal = true;
+	scale->m_changeThreshold = 1.f / stepsPerOctave / 2.f;
+	return scale;
+}
+
+std::unique_ptr<Scale> Scale::EqualDivision(int stepsPerOctave)
+{
+	int intervals[maxScaleSteps];
+	std::fill(intervals, intervals + stepsPerOctave, 1);
+	std::ostringstream name;
+	name << stepsPerOctave << "-EDO";
+	return Equal(name.str(), stepsPerOctave, intervals, stepsPerOctave);
+}
+
+// A Scala pitch: cents if it has a decimal point, otherwise a ratio (or a whole number)
+static bool parseScalaPitch(const std::string &line, float &volts)
+{
+	std::istringstream stream(line);
+	std::string token;
+	stream >> token;
+	if( token.empty() ) {
+		return false;
+	}
+	char *end = NULL;
+	if( token.find('.') != std::string::npos ) {
+		double cents = strtod(token.c_str(), &end);
+		volts = (float)(cents / 1200.0);
+		return *end == '\0';
+	}
+	long numerator = strtol(token.c_str(), &end, 10);
+	long denominator = 1;
+	if( *end == '/' ) {
+		denominator = strtol(end + 1, &end, 10);
+	}
+	if( *end != '\0' || numerator <= 0 || denominator <= 0 ) {
+		return false;
+	}
+	volts = (float)std::log2((double)numerator / denominator);
+	return true;
+}
+
+std::unique_ptr<Scale> Scale::FromScala(const std::string &text, std::string &error)
+{
+	// Gather the lines that aren't comments
+	std::istringstream stream(text);
+	std::string line;
+	std::string lines[maxScaleSteps + 2];
+	int numLines = 0;
+	int expectedLines = 2;
+	while( numLines < expectedLines && std::getline(stream, line) ) {
+		if( !line.empty() && line.back() == '\r' ) {
+			line.pop_back();
+		}
+		if( !line.empty() && line[0] == '!' ) {
+			continue;
+		}
+		lines[numLines++] = line;
+		if( numLines == 2 ) {
+			int numPitches = atoi(lines[1].c_str());
+			if( numPitches < 1 || numPitches > maxScaleSteps ) {
+				std::ostringstream message;
+				message << "A scale must have between 1 and " << maxScaleSteps << " notes";
+				error = message.str();
+				return NULL;
+			}
+			expectedLines = 2 + numPitches;
+		}
+	}
+	if( numLines < expectedLines ) {
+		error = "The file ends before all of the scale's notes";
+		return NULL;
+	}
+
+	// Step 0 is the tonic, and the last pitch in the file is the period (usually the octave)
+	int stepsPerOctave = expectedLines - 2;
+	float stepVolts[maxScaleSteps + 1];
+	bool stepInScale[maxScaleSteps];
+	stepVolts[0] = 0.f;
+	for( int step = 1; step <= stepsPerOctave; step++ ) {
+		if( !parseScalaPitch(lines[step + 1], stepVolts[step]) ) {
+			error = "Can't read the pitch \"" + lines[step + 1] + "\"";
+			return NULL;
+		}
+		if( stepVolts[step] <= stepVolts[step - 1] ) {
+			error = "The scale's pitches must go up";
+			return NULL;
+		}
+		stepInScale[step - 1] = true;
+	}
+
+	std::string name = lines[0].empty() ? std::string("Scala scale") : lines[0];
+	return std::unique_ptr<Scale>(new Scale(name, stepsPerOctave, stepVolts[stepsPerOctave], stepVolts, stepInScale));
+}
+
+// Intervals in semitones between the notes of the built-in scales
+static const int diatonicIntervals[] = {2, 2, 1, 2, 2, 2, 1};
+static const int harmonicMinorIntervals[] = {2, 2, 1, 3, 1, 2, 1};	// From the relative major, so that Aeolian is the harmonic minor
+static const int pentatonicIntervals[] = {2, 2, 3, 2, 3};
+
+struct BuiltInScales
+{
+	std::unique_ptr<Scale> scales[NUM_BUILT_IN_SCALES];
+	BuiltInScales()
+	{
+		scales[DIATONIC_SCALE] = Scale::Equal("Diatonic", 12, diatonicIntervals, 7);
+		scales[HARMONIC_MINOR_SCALE] = Scale::Equal("Harmonic minor", 12, harmonicMinorIntervals, 7);
+		scales[PENTATONIC_SCALE] = Scale::Equal("Pentatonic", 12, pentatonicIntervals, 5);
+	}
+};
+
+static const BuiltInScales builtInScales;
+
+const Scale &builtInScale(int scale)
+{
+	assert(scale >= 0 && scale < NUM_BUILT_IN_SCALES);
+	return *builtInScales.scales[scale];
+}
+
+const Scale *scaleFromSpec(const std::string &spec, std::unique_ptr<Scale> &owned, std::string &error)
+{
+	size_t colon = spec.find(':');
+	std::string kind = spec.substr(0, colon);
+	std::string value = colon == std::string::npos ? "" : spec.substr(colon + 1);
+	if( kind == "scala" ) {
+		owned = Scale::FromScala(value, error);
+		return owned.get();
+	}
+	char *end = NULL;
+	long number = std::strtol(value.c_str(), &end, 10);
+	bool isNumber = !value.empty() && *end == 0;
+	if( kind == "builtin" && isNumber && number >= 0 && number < NUM_BUILT_IN_SCALES ) {
+		return &builtInScale((int)number);
+	}
+	if( kind == "edo" && isNumber && number >= 1 && number <= maxScaleSteps ) {
+		owned = Scale::EqualDivision((int)number);
+		return owned.get();
+	}
+	error = "Unknown scale \"" + spec.substr(0, 40) + "\"";
+	return NULL;
+}
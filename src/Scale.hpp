@@ -0,0 +1,163 @@
+#pragma once
+
+// Scales and tunings, compiled into dense lookup tables when they are loaded, so that quantizing
+// a voltage to a scale and finding the pitches of its notes cost the same whatever the scale.
+// Like ChordCore, this doesn't depend on Rack.
+
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <algorithm>
+#include <string>
+
+inline int niceModulo(int x, int y)
+{
+	int z = x % y;
+	if( z >=0 ) {
+		return z;
+	}
+	return z + y;
+}
+
+const int maxScaleSteps = 72;		// Steps per octave in a tuning, enough for 72-EDO
+const int numModes = 7;				// Positions of the MODE knob
+const int numKeys = 12;				// Positions of the KEYSIG knob, in 12-EDO semitones
+
+// A tuning is a grid of steps in each octave (or other period): the 12 semitones, the N steps of
+// an N-EDO, or the degrees of a Scala file. The scale's notes are some or all of those steps.
+// Steps that are not in the scale are out of key, and belong to the note below them (like the
+// black keys in a diatonic scale).
+// Modes rotate the scale, so that the mode's tonic is the mode'th note of the scale (modulo the
+// number of notes). The key sig puts the mode's tonic on that 12-EDO semitone above C (0V), or on
+// the nearest step to it in an equal tuning.
+// Steps and notes are counted from the mode's tonic in the octave above C, and can be negative.
+class Scale
+{
+	private:
+		static const int quantizeBins = 4096;	// Per octave, for quantizing unequal tunings
+
+		std::string m_name;
+		uint16_t m_id;							// Different for every Scale compiled, so that tables built for one can't be mistaken for another
+		int m_stepsPerOctave;
+		int m_notesPerOctave;
+		float m_periodVolts;					// 1 for an octave
+		bool m_equal;							// Equal steps can be quantized and pitched arithmetically
+		int m_keyStep[numKeys];					// Equal tunings: the nearest step above C to each key sig
+		float m_changeThreshold;				// Half the smallest step, in volts
+
+		// Per mode. Steps and notes within the octave.
+		int m_noteOfStep[numModes][maxScaleSteps];		// The note each step is, or belongs to
+		bool m_outOfKey[numModes][maxScaleSteps];		// True if the step is not in the scale
+		int m_stepOfNote[numModes][maxScaleSteps];		// The step each note is on
+		float m_stepVolts[numModes][maxScaleSteps];		// Unequal tunings: the pitch of each step above the tonic
+		float m_lowerBoundary[numModes][maxScaleSteps + 1];	// Unequal tunings: the lowest pitch that quantizes to each step (and to the next octave's tonic)
+		uint8_t m_binStep[numModes][quantizeBins];		// Unequal tunings: the step for the pitch at the bottom of each bin
+		uint8_t m_chordNotes[numModes][maxScaleSteps][3];	// The root, third and fifth of the chord on each note, in notes above it
+
+		Scale(const std::string &name, int stepsPerOctave, float periodVolts, const float *stepVolts, const bool *stepInScale);
+
+	public:
+		// An equal tuning of stepsPerOctave steps, with the notes of the scale separated by intervals (in steps)
+		static std::unique_ptr<Scale> Equal(const std::string &name, int stepsPerOctave, const int *intervals, int numIntervals);
+		// Every step of stepsPerOctave equal temperament is a note
+		static std::unique_ptr<Scale> EqualDivision(int stepsPerOctave);
+		// Parses the text of a Scala (.scl) file. Every degree of a Scala scale is a note.
+		// Returns NULL, with a description of the problem in error, if the text isn't a usable scale.
+		static std::unique_ptr<Scale> FromScala(const std::string &text, std::string &error);
+
+		const std::string &Name() const {return m_name;}
+		uint16_t Id() const {return m_id;}
+		int StepsPerOctave() const {return m_stepsPerOctave;}
+		int NotesPerOctave() const {return m_notesPerOctave;}
+		// Pitch changes smaller than this are wobble rather than a new key
+		float ChangeThreshold() const {return m_changeThreshold;}
+		// True if every step is a note and the steps are equal (an N-EDO), so that the chord on every
+		// note is the same shape whatever the key sig and mode
+		bool EqualDivision() const {return m_equal && m_notesPerOctave == m_stepsPerOctave;}
+
+		// The note of the chord on root (counted in notes of the scale from root) for each voice:
+		// the root, third and fifth, doubled up the octaves. In scales of five to seven notes the third
+		// and fifth are stacked two notes apart. Finer scales (EDOs, and Scala files of more than seven
+		// notes) would stack up a cluster that way, so their third and fifth are the notes nearest in
+		// pitch to a just major third and fifth (as fractions of the period) above that root.
+		// Scales of fewer than five notes don't have thirds to stack, so their chords are consecutive
+		// notes instead.
+		int ChordDegree(int root, int mode, int voice) const
+		{
+			assert(mode >= 0 && mode < numModes);
+			if( m_notesPerOctave < 5 ) {
+				return voice;
+			}
+			return m_chordNotes[mode][niceModulo(root, m_notesPerOctave)][voice % 3] + (voice / 3) * m_notesPerOctave;
+		}
+
+		// The step nearest to voltage
+		int Quantize(float voltage, int key, int mode) const
+		{
+			assert(key >= 0 && key < numKeys);
+			assert(mode >= 0 && mode < numModes);
+			if( m_equal ) {
+				return (int)(std::round(voltage * m_stepsPerOctave / m_periodVolts)) - m_keyStep[key];
+			}
+			float relative = voltage - key / 12.f;
+			int octave = (int)std::floor(relative / m_periodVolts);
+			float withinOctave = relative - octave * m_periodVolts;
+			int bin = std::min(std::max((int)(withinOctave / m_periodVolts * quantizeBins), 0), quantizeBins - 1);
+			int step = m_binStep[mode][bin];
+			while( step < m_stepsPerOctave && withinOctave >= m_lowerBoundary[mode][step + 1] ) {
+				step++;
+			}
+			return step + octave * m_stepsPerOctave;
+		}
+		// The note that step is (or belongs to, if it is out of key)
+		int StepToNote(int step, int mode, bool *outOfKey) const
+		{
+			assert(mode >= 0 && mode < numModes);
+			int stepModulo = niceModulo(step, m_stepsPerOctave);
+			int octave = (step - stepModulo) / m_stepsPerOctave;
+			*outOfKey = m_outOfKey[mode][stepModulo];
+			return m_noteOfStep[mode][stepModulo] + octave * m_notesPerOctave;
+		}
+		bool OutOfKey(int step, int mode) const
+		{
+			return m_outOfKey[mode][niceModulo(step, m_stepsPerOctave)];
+		}
+		int NoteToStep(int note, int mode) const
+		{
+			assert(mode >= 0 && mode < numModes);
+			int noteModulo = niceModulo(note, m_notesPerOctave);
+			int octave = (note - noteModulo) / m_notesPerOctave;
+			return m_stepOfNote[mode][noteModulo] + octave * m_stepsPerOctave;
+		}
+		// The pitch of a step
+		float StepToVoltage(int step, int key, int mode) const
+		{
+			assert(key >= 0 && key < numKeys);
+			assert(mode >= 0 && mode < numModes);
+			if( m_equal ) {
+				return (float)(step + m_keyStep[key]) / m_stepsPerOctave * m_periodVolts;
+			}
+			int stepModulo = niceModulo(step, m_stepsPerOctave);
+			int octave = (step - stepModulo) / m_stepsPerOctave;
+			return key / 12.f + octave * m_periodVolts + m_stepVolts[mode][stepModulo];
+		}
+};
+
+// The scales that are always available, compiled when the plugin is loaded
+enum BuiltInScale
+{
+	DIATONIC_SCALE,			// 12-EDO major scale and its modes
+	HARMONIC_MINOR_SCALE,	// 12-EDO, with Aeolian the harmonic minor
+	PENTATONIC_SCALE,		// 12-EDO major pentatonic (and minor pentatonic as mode 4)
+	NUM_BUILT_IN_SCALES
+};
+
+const Scale &builtInScale(int scale);
+
+// The scale described by a spec, as the module writes in traces: "builtin:" and a BuiltInScale,
+// "edo:" and the steps per octave, or "scala:" and the text of a Scala file. Built-in scales are
+// returned as they are; others are compiled into owned. Returns NULL, with a description of the
+// problem in error, if the spec isn't a usable scale.
+const Scale *scaleFromSpec(const std::string &spec, std::unique_ptr<Scale> &owned, std::string &error);
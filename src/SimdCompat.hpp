@@ -0,0 +1,108 @@
+#pragma once
+
+// float_4 for the Rack-independent code. In the plugin this is Rack's own simd::float_4. The
+// standalone tools (built with CHORDROLLOVER_STANDALONE) get a minimal portable stand-in with the
+// same interface, covering just what the engine uses. Call the free functions unqualified, so that
+// argument-dependent lookup finds Rack's versions in the plugin.
+
+#ifndef CHORDROLLOVER_STANDALONE
+
+#include <rack.hpp>
+
+typedef rack::simd::float_4 float_4;
+
+#else
+
+#include <cstdint>
+#include <cstring>
+
+struct float_4
+{
+	float s[4];
+
+	float_4() {}
+	float_4(float x) {s[0] = x; s[1] = x; s[2] = x; s[3] = x;}
+	float_4(float a, float b, float c, float d) {s[0] = a; s[1] = b; s[2] = c; s[3] = d;}
+	static float_4 zero() {return float_4(0.f);}
+	static float_4 mask()
+	{
+		float_4 result;
+		std::memset(result.s, 0xFF, sizeof(result.s));
+		return result;
+	}
+	static float_4 load(const float* p) {return float_4(p[0], p[1], p[2], p[3]);}
+	void store(float* p) const {std::memcpy(p, s, sizeof(s));}
+	float& operator[](int i) {return s[i];}
+	const float& operator[](int i) const {return s[i];}
+};
+
+namespace float_4_detail {
+	inline uint32_t bits(float x) {uint32_t b; std::memcpy(&b, &x, sizeof(b)); return b;}
+	inline float fromBits(uint32_t b) {float x; std::memcpy(&x, &b, sizeof(x)); return x;}
+	inline float maskLane(bool b) {return fromBits(b ? 0xFFFFFFFFu : 0u);}
+}
+
+#define FLOAT_4_ARITHMETIC(op) \
+	inline float_4 operator op(const float_4& a, const float_4& b) {return float_4(a.s[0] op b.s[0], a.s[1] op b.s[1], a.s[2] op b.s[2], a.s[3] op b.s[3]);} \
+	inline float_4& operator op##=(float_4& a, const float_4& b) {a = a op b; return a;}
+FLOAT_4_ARITHMETIC(+)
+FLOAT_4_ARITHMETIC(-)
+FLOAT_4_ARITHMETIC(*)
+FLOAT_4_ARITHMETIC(/)
+#undef FLOAT_4_ARITHMETIC
+
+inline float_4 operator-(const float_4& a) {return float_4(-a.s[0], -a.s[1], -a.s[2], -a.s[3]);}
+
+// Comparisons give masks, with every bit of a lane set where the comparison is true
+#define FLOAT_4_COMPARISON(op) \
+	inline float_4 operator op(const float_4& a, const float_4& b) { \
+		using namespace float_4_detail; \
+		return float_4(maskLane(a.s[0] op b.s[0]), maskLane(a.s[1] op b.s[1]), maskLane(a.s[2] op b.s[2]), maskLane(a.s[3] op b.s[3])); \
+	}
+FLOAT_4_COMPARISON(==)
+FLOAT_4_COMPARISON(!=)
+FLOAT_4_COMPARISON(<)
+FLOAT_4_COMPARISON(>)
+FLOAT_4_COMPARISON(<=)
+FLOAT_4_COMPARISON(>=)
+#undef FLOAT_4_COMPARISON
+
+#define FLOAT_4_BITWISE(op) \
+	inline float_4 operator op(const float_4& a, const float_4& b) { \
+		using namespace float_4_detail; \
+		return float_4(fromBits(bits(a.s[0]) op bits(b.s[0])), fromBits(bits(a.s[1]) op bits(b.s[1])), fromBits(bits(a.s[2]) op bits(b.s[2])), fromBits(bits(a.s[3]) op bits(b.s[3]))); \
+	}
+FLOAT_4_BITWISE(&)
+FLOAT_4_BITWISE(|)
+FLOAT_4_BITWISE(^)
+#undef FLOAT_4_BITWISE
+
+inline float_4 operator~(const float_4& a)
+{
+	return a ^ float_4::mask();
+}
+
+// Lanes of a where mask is set, otherwise lanes of b
+inline float_4 ifelse(const float_4& mask, const float_4& a, const float_4& b)
+{
+	return (a & mask) | (b & ~mask);
+}
+
+inline float_4 fmax(const float_4& a, const float_4& b)
+{
+	return float_4(a.s[0] > b.s[0] ? a.s[0] : b.s[0], a.s[1] > b.s[1] ? a.s[1] : b.s[1], a.s[2] > b.s[2] ? a.s[2] : b.s[2], a.s[3] > b.s[3] ? a.s[3] : b.s[3]);
+}
+
+inline float_4 fmin(const float_4& a, const float_4& b)
+{
+	return float_4(a.s[0] < b.s[0] ? a.s[0] : b.s[0], a.s[1] < b.s[1] ? a.s[1] : b.s[1], a.s[2] < b.s[2] ? a.s[2] : b.s[2], a.s[3] < b.s[3] ? a.s[3] : b.s[3]);
+}
+
+// One bit per lane, set where the lane's sign bit is set (so for every true lane of a mask)
+inline int movemask(const float_4& a)
+{
+	using namespace float_4_detail;
+	return (bits(a.s[0]) >> 31) | ((bits(a.s[1]) >> 31) << 1) | ((bits(a.s[2]) >> 31) << 2) | ((bits(a.s[3]) >> 31) << 3);
+}
+
+#endif
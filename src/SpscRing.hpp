@@ -0,0 +1,60 @@
+#pragma once
+
+// Lock-free queue of fixed-size slots from one producer thread to one consumer thread.
+// Doesn't depend on Rack.
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+
+// The slots are allocated once, by the constructor, so pushing and popping never touch the heap.
+// The producer fills the slot from BeginPush() in place and hands it over with EndPush(); the
+// consumer reads the slot from Front() in place and gives it back with Pop(). Neither thread ever
+// waits for the other: BeginPush() returns NULL when the ring is full, and Front() when it is empty.
+template <typename T>
+class SpscRing
+{
+	private:
+		std::unique_ptr<T[]> m_slots;
+		size_t m_mask;
+		std::atomic<size_t> m_head;		// Slots pushed so far, written by the producer
+		char m_padding[64];				// Keeps the two counters in different cache lines
+		std::atomic<size_t> m_tail;		// Slots popped so far, written by the consumer
+	public:
+		// capacity must be a power of two
+		explicit SpscRing(size_t capacity)
+		: m_slots(new T[capacity]), m_mask(capacity - 1), m_head(0), m_tail(0)
+		{
+			assert(capacity > 0 && (capacity & m_mask) == 0);
+		}
+		size_t Capacity() const {return m_mask + 1;}
+
+		// Called by the producer
+		T *BeginPush()
+		{
+			size_t head = m_head.load(std::memory_order_relaxed);
+			if( head - m_tail.load(std::memory_order_acquire) > m_mask ) {
+				return NULL;
+			}
+			return &m_slots[head & m_mask];
+		}
+		void EndPush()
+		{
+			m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		// Called by the consumer
+		const T *Front() const
+		{
+			size_t tail = m_tail.load(std::memory_order_relaxed);
+			if( tail == m_head.load(std::memory_order_acquire) ) {
+				return NULL;
+			}
+			return &m_slots[tail & m_mask];
+		}
+		void Pop()
+		{
+			m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+};
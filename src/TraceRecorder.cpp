@@ -0,0 +1,105 @@
+#include "TraceRecorder.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+const char traceMagic[8] = {'C', 'R', 'T', 'R', 'A', 'C', 'E', 0};
+
+void writeTraceHeader(std::FILE *file, const std::string &scaleSpec)
+{
+	TraceFileHeader header;
+	std::memcpy(header.magic, traceMagic, sizeof(header.magic));
+	header.version = traceVersion;
+	header.scaleSpecBytes = (uint32_t)scaleSpec.size();
+	std::fwrite(&header, sizeof(header), 1, file);
+	std::fwrite(scaleSpec.data(), 1, scaleSpec.size(), file);
+}
+
+void writeTraceRecord(std::FILE *file, const TraceFrame &frame, uint32_t skippedSamples)
+{
+	TraceRecordHeader record;
+	record.skippedSamples = skippedSamples;
+	record.sampleTime = frame.sampleTime;
+	std::copy(frame.params, frame.params + traceParams, record.params);
+	record.numVoices = (uint8_t)frame.numVoices;
+	record.outputChannels = (uint8_t)frame.outputChannels;
+	record.reserved = 0;
+	std::fwrite(&record, sizeof(record), 1, file);
+	std::fwrite(frame.voct, sizeof(float), frame.numVoices, file);
+	std::fwrite(frame.gate, sizeof(float), frame.numVoices, file);
+	std::fwrite(frame.pitchOutputs, sizeof(float), frame.outputChannels, file);
+	std::fwrite(frame.gateOutputs, sizeof(float), frame.outputChannels, file);
+}
+
+TraceRecorder::TraceRecorder()
+: m_recording(false)
+, m_session(0)
+, m_stopping(false)
+, m_audioSession(0)
+, m_audioSample(0)
+{
+}
+
+TraceRecorder::~TraceRecorder()
+{
+	Stop();
+}
+
+bool TraceRecorder::Start(const std::string &path, const std::string &scaleSpec)
+{
+	Stop();
+	std::FILE *file = std::fopen(path.c_str(), "wb");
+	if( !file ) {
+		return false;
+	}
+	if( !m_ring ) {
+		m_ring.reset(new SpscRing<TraceFrame>(ringFrames));
+		m_fileBuffer.reset(new char[fileBufferBytes]);
+	}
+	std::setvbuf(file, m_fileBuffer.get(), _IOFBF, fileBufferBytes);
+	writeTraceHeader(file, scaleSpec);
+
+	// Frames that the audio thread was part way through handing over when the last recording
+	// stopped are still in the ring. The new session number tells the writer to skip them.
+	uint32_t session = m_session.load() + 1;
+	m_session.store(session);
+	m_stopping = false;
+	// Neither the audio thread nor a writer is counting while there's no recording
+	m_stats.framesWritten.Set(0);
+	m_stats.framesDropped.Set(0);
+	m_writer = std::thread(&TraceRecorder::Write, this, file, session);
+	m_recording.store(true, std::memory_order_release);
+	return true;
+}
+
+void TraceRecorder::Stop()
+{
+	if( !m_writer.joinable() ) {
+		return;
+	}
+	m_recording = false;
+	m_stopping = true;
+	m_writer.join();
+}
+
+void TraceRecorder::Write(std::FILE *file, uint32_t session)
+{
+	uint64_t nextSample = 0;
+	for( ;; ) {
+		// Once stopping is seen, one more pass picks up everything the audio thread recorded
+		bool stopping = m_stopping.load();
+		while( const TraceFrame *frame = m_ring->Front() ) {
+			if( frame->session == session ) {
+				writeTraceRecord(file, *frame, (uint32_t)(frame->sample - nextSample));
+				nextSample = frame->sample + 1;
+				m_stats.framesWritten.Add(1);
+			}
+			m_ring->Pop();
+		}
+		if( stopping ) {
+			break;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	std::fclose(file);
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+// Records the module's inputs, knobs and outputs, sample by sample, to a binary trace file, so
+// that a glide someone reports can be replayed exactly. The audio thread only fills in slots of
+// a preallocated ring; a background thread writes them to the file.
+// Like ChordCore, this doesn't depend on Rack.
+
+#include "ChordEngine.hpp"
+#include "Profiling.hpp"
+#include "SpscRing.hpp"
+#include <cstdio>
+#include <string>
+#include <thread>
+
+const int traceParams = NUM_ENGINE_PARAMS;		// The knobs, in EngineParam order
+
+// One sample, as the audio thread hands it to the writer
+struct TraceFrame
+{
+	uint32_t session;		// Which recording the frame belongs to
+	uint64_t sample;		// Samples since the recording started, counting dropped ones
+	float sampleTime;
+	float params[traceParams];
+	int numVoices;
+	int outputChannels;
+	float voct[maxEngineVoices];
+	float gate[maxEngineVoices];
+	float pitchOutputs[maxChordNotes];
+	float gateOutputs[maxChordNotes];
+};
+
+// The trace file is a TraceFileHeader, then the header's scaleSpecBytes of scale spec (see
+// TraceRecorder::Start()), then a record for each sample recorded: a TraceRecordHeader followed by
+// numVoices VOCT inputs, numVoices GATE inputs, outputChannels pitch outputs and outputChannels
+// gate outputs, as floats. Everything is in native byte order (little-endian on every platform
+// that Rack runs on).
+struct TraceFileHeader
+{
+	char magic[8];				// traceMagic
+	uint32_t version;			// traceVersion
+	uint32_t scaleSpecBytes;
+};
+
+struct TraceRecordHeader
+{
+	uint32_t skippedSamples;	// Samples dropped before this one, because the writer fell behind
+	float sampleTime;
+	float params[traceParams];
+	uint8_t numVoices;
+	uint8_t outputChannels;
+	uint16_t reserved;
+};
+
+static_assert(sizeof(TraceFileHeader) == 16, "Trace files are read back with the same layout");
+static_assert(sizeof(TraceRecordHeader) == 48, "Trace files are read back with the same layout");
+
+extern const char traceMagic[8];
+const uint32_t traceVersion = 3;		// 2 added the glide curve param, 3 the strum params
+
+// For writing trace files directly, rather than through a TraceRecorder
+void writeTraceHeader(std::FILE *file, const std::string &scaleSpec);
+void writeTraceRecord(std::FILE *file, const TraceFrame &frame, uint32_t skippedSamples);
+
+// Written by the audio thread (dropped) and the writer thread (written)
+struct TraceStats
+{
+	SharedStat<uint64_t> framesWritten;
+	SharedStat<uint64_t> framesDropped;
+};
+
+class TraceRecorder
+{
+	private:
+		static const size_t ringFrames = 1 << 15;		// About 0.7s at 48kHz, and 10MB
+		static const size_t fileBufferBytes = 1 << 20;
+
+		std::unique_ptr<SpscRing<TraceFrame>> m_ring;	// Allocated by the first Start(), then kept until the recorder is destroyed
+		std::unique_ptr<char[]> m_fileBuffer;			// Likewise. Only used by the writer thread.
+		std::atomic<bool> m_recording;
+		std::atomic<uint32_t> m_session;
+		std::atomic<bool> m_stopping;
+		uint32_t m_audioSession;			// Only used by the audio thread
+		uint64_t m_audioSample;				// Only used by the audio thread
+		TraceStats m_stats;
+		std::thread m_writer;
+
+		void Write(std::FILE *file, uint32_t session);
+	public:
+		TraceRecorder();
+		~TraceRecorder();
+
+		// Called by the UI thread. Starts writing a trace to path, for a module using the scale
+		// described by scaleSpec, stopping any recording that is already going.
+		// Returns false if the file can't be opened.
+		bool Start(const std::string &path, const std::string &scaleSpec);
+		// Called by the UI thread. Returns once everything recorded has been written.
+		void Stop();
+		bool Recording() const {return m_recording.load(std::memory_order_relaxed);}
+		const TraceStats &Stats() const {return m_stats;}
+
+		// Called by the audio thread every sample. The frame to fill in and hand over with
+		// EndFrame(), or NULL if there's no recording (or the ring is full, and the sample is dropped).
+		TraceFrame *BeginFrame()
+		{
+			if( !m_recording.load(std::memory_order_acquire) ) {
+				return NULL;
+			}
+			uint32_t session = m_session.load(std::memory_order_relaxed);
+			if( session != m_audioSession ) {
+				m_audioSession = session;
+				m_audioSample = 0;
+			}
+			uint64_t sample = m_audioSample++;
+			TraceFrame *frame = m_ring->BeginPush();
+			if( !frame ) {
+				m_stats.framesDropped.Add(1);
+				return NULL;
+			}
+			frame->session = session;
+			frame->sample = sample;
+			return frame;
+		}
+		void EndFrame()
+		{
+			m_ring->EndPush();
+		}
+};
@@ -0,0 +1,197 @@
+#include "TransitionTable.hpp"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+void TransitionTable::Build(const TransitionParams &transitionParams, const Scale &scale, JumbleWorkspace &workspace, JumbleStats *stats, DiagnosticChannel *diagnostics)
+{
+	assert(scale.Id() == transitionParams.scaleId);
+	int key = transitionParams.key;
+	int mode = transitionParams.mode;
+	numNotes = transitionParams.numNotes;
+	rows = scale.EqualDivision() ? 1 : scale.NotesPerOctave();
+	reach = transitionReach(scale.NotesPerOctave());
+	voiceTargets.resize(rows * (2 * reach + 1) * numNotes);
+	int bypassed = 0;
+	for( int fromNote = 0; fromNote < rows; fromNote++ ) {
+		ChordPitches fromPitches = chordPitchesForNote(fromNote, scale, key, mode, numNotes);
+		for( int step = -reach; step <= reach; step++ ) {
+			ChordPitches toPitches = chordPitchesForNote(fromNote + step, scale, key, mode, numNotes);
+			int order[maxJumbleNotes];
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			if( jumbleOrder(toPitches, fromPitches, transitionParams.jumbleAmount, workspace, order) ) {
+				bypassed++;
+			}
+			if( stats ) {
+				stats->calls.Add(1);
+				stats->worstNs.Max(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+			}
+			uint8_t *targets = &voiceTargets[(fromNote * (2 * reach + 1) + step + reach) * numNotes];
+			for( int voice = 0; voice < numNotes; voice++ ) {
+				targets[voice] = (uint8_t)order[voice];
+			}
+		}
+	}
+	if( diagnostics && bypassed > 0 ) {
+		diagnostics->Post(JUMBLE_BYPASSED_EVENT, (float)bypassed, (float)(rows * (2 * reach + 1)));
+	}
+	params = transitionParams.Pack();
+	valid = true;
+}
+
+// The worker thread that builds every (asynchronous) builder's tables. It runs while there are any.
+// It sleeps until a builder's audio thread has a request for it, and then builds the latest request
+// of each builder that is behind, one builder at a time so that none of them waits for long.
+// The audio thread mustn't wait for the lock to wake it, so it only try_locks (see Wake()).
+class TransitionWorker
+{
+	private:
+		std::mutex m_lifetimeMutex;			// Held while builders register and unregister, which starts and stops the thread
+		std::mutex m_mutex;					// Guards the rest, apart from m_pending
+		std::condition_variable m_wake;		// For the worker
+		std::condition_variable m_idle;		// For Unregister(), while the worker builds for the builder going
+		std::vector<TransitionTableBuilder*> m_builders;
+		std::atomic<bool> m_pending;		// A builder has a request the worker may not have seen
+		bool m_quit;
+		std::unique_ptr<JumbleWorkspace> m_workspace;
+		std::thread m_thread;
+
+		void Run()
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			while( true ) {
+				m_wake.wait(lock, [this] {return m_quit || m_pending.load();});
+				if( m_quit ) {
+					return;
+				}
+				// Cleared before looking, so that a request made while the worker looks sets it again
+				m_pending.store(false);
+				for( size_t i = 0; i < m_builders.size(); i++ ) {
+					TransitionTableBuilder *builder = m_builders[i];
+					builder->m_building = true;
+					lock.unlock();
+					builder->BuildRequested(*m_workspace);
+					lock.lock();
+					builder->m_building = false;
+					m_idle.notify_all();
+				}
+			}
+		}
+
+	public:
+		static TransitionWorker &Instance()
+		{
+			static TransitionWorker worker;
+			return worker;
+		}
+
+		TransitionWorker() : m_pending(false), m_quit(false), m_workspace(new JumbleWorkspace) {}
+		~TransitionWorker()
+		{
+			// Only if a builder outlived everything else
+			if( m_thread.joinable() ) {
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_quit = true;
+				}
+				m_wake.notify_one();
+				m_thread.join();
+			}
+		}
+
+		void Register(TransitionTableBuilder *builder)
+		{
+			std::lock_guard<std::mutex> lifetimeLock(m_lifetimeMutex);
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_builders.push_back(builder);
+				m_quit = false;
+			}
+			if( !m_thread.joinable() ) {
+				m_thread = std::thread(&TransitionWorker::Run, this);
+			}
+		}
+
+		void Unregister(TransitionTableBuilder *builder)
+		{
+			std::lock_guard<std::mutex> lifetimeLock(m_lifetimeMutex);
+			bool last;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_idle.wait(lock, [builder] {return !builder->m_building;});
+				m_builders.erase(std::find(m_builders.begin(), m_builders.end(), builder));
+				last = m_builders.empty();
+				m_quit = last;
+				// The worker may be part way through the builders, and would skip the one after this
+				m_pending.store(true);
+			}
+			if( last ) {
+				m_wake.notify_one();
+				m_thread.join();
+			}
+		}
+
+		// Called by the audio thread, after storing a request. Holding the lock (however briefly) means
+		// that the worker is either asleep, and is woken, or yet to check m_pending, and will see it.
+		// If the lock is taken, the worker may be just about to sleep, so the caller must try again.
+		bool Wake()
+		{
+			m_pending.store(true);
+			std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+			if( !lock.owns_lock() ) {
+				return false;
+			}
+			lock.unlock();
+			m_wake.notify_one();
+			return true;
+		}
+};
+
+TransitionTableBuilder::TransitionTableBuilder(bool synchronous)
+: m_synchronous(synchronous)
+, m_requested(0)
+, m_requestedScale(NULL)
+, m_lastRequested(0)
+, m_wakePending(false)
+, m_built(0)
+, m_building(false)
+{
+	if( m_synchronous ) {
+		m_workspace.reset(new JumbleWorkspace);
+	} else {
+		TransitionWorker::Instance().Register(this);
+	}
+}
+
+TransitionTableBuilder::~TransitionTableBuilder()
+{
+	if( !m_synchronous ) {
+		TransitionWorker::Instance().Unregister(this);
+	}
+}
+
+bool TransitionTableBuilder::WakeWorker()
+{
+	return TransitionWorker::Instance().Wake();
+}
+
+void TransitionTableBuilder::BuildRequested(JumbleWorkspace &workspace)
+{
+	// Packed params are never 0, as numNotes is at least 1
+	uint64_t requested = m_requested.load();
+	if( requested == m_built ) {
+		return;
+	}
+	TransitionParams params = TransitionParams::Unpack(requested);
+	const Scale *scale = m_requestedScale.load();
+	if( scale->Id() != params.scaleId ) {
+		// Caught the audio thread between storing a new scale and its params, which will wake the worker again
+		return;
+	}
+	m_tables.Back().Build(params, *scale, workspace, &m_stats, &m_diagnostics);
+	m_tables.Publish();
+	m_built = requested;
+}
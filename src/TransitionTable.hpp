@@ -0,0 +1,197 @@
+#pragma once
+
+// Voice assignments for rollovers, worked out ahead of time on a worker thread.
+// Like ChordCore, this doesn't depend on Rack.
+
+#include "ChordCore.hpp"
+#include "DiagnosticLog.hpp"
+#include "Profiling.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// Lock-free handover of whole objects from one writer thread to one reader thread.
+// The writer fills Back() and then calls Publish(). The reader calls Fetch() to pick up the
+// most recently published object (if there is a new one) and may then read Front() for as long
+// as it likes. Neither thread ever waits for the other.
+template <typename T>
+class TripleBuffer
+{
+	private:
+		static const int newFlag = 4;	// Set in m_middle when it holds an object the reader hasn't seen
+		T m_buffers[3];
+		int m_back;						// Owned by the writer
+		int m_front;					// Owned by the reader
+		std::atomic<int> m_middle;		// Swapped between them
+	public:
+		TripleBuffer() : m_back(0), m_front(1), m_middle(2) {}
+		T &Back() {return m_buffers[m_back];}
+		void Publish()
+		{
+			m_back = m_middle.exchange(m_back | newFlag, std::memory_order_acq_rel) & ~newFlag;
+		}
+		bool Fetch()
+		{
+			if( !(m_middle.load(std::memory_order_relaxed) & newFlag) ) {
+				return false;
+			}
+			m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & ~newFlag;
+			return true;
+		}
+		const T &Front() const {return m_buffers[m_front];}
+};
+
+const int jumbleTableSteps = 100;	// Tables are built for jumble amounts this far apart (0.01)
+
+// Everything that the choice of voice assignment for a rollover depends on (apart from the notes)
+struct TransitionParams
+{
+	int key;
+	int mode;
+	int numNotes;
+	float jumbleAmount;		// One of the jumbleTableSteps + 1 amounts that QuantizeJumble() gives
+	uint16_t scaleId;		// Scale::Id() of the scale
+
+	// The nearest jumble amount that tables are built for. A CV sweeping the jumble (which would
+	// otherwise ask for a new table every time it moves the slightest bit) only asks for a new table
+	// as it crosses each step.
+	static float QuantizeJumble(float jumbleAmount)
+	{
+		return std::round(jumbleAmount * jumbleTableSteps) / jumbleTableSteps;
+	}
+
+	// Packed into one word so that it can be handed between threads atomically
+	uint64_t Pack() const
+	{
+		uint32_t jumbleBits;
+		std::memcpy(&jumbleBits, &jumbleAmount, sizeof(jumbleBits));
+		return ((uint64_t)jumbleBits << 32) | (uint64_t)(key | (mode << 4) | (numNotes << 8) | ((uint32_t)scaleId << 16));
+	}
+	static TransitionParams Unpack(uint64_t packed)
+	{
+		TransitionParams params;
+		uint32_t jumbleBits = (uint32_t)(packed >> 32);
+		std::memcpy(&params.jumbleAmount, &jumbleBits, sizeof(jumbleBits));
+		params.key = packed & 0xF;
+		params.mode = (packed >> 4) & 0xF;
+		params.numNotes = (packed >> 8) & 0xFF;
+		params.scaleId = (packed >> 16) & 0xFFFF;
+		return params;
+	}
+	// A packed TransitionParams without its jumble amount
+	static uint64_t WithoutJumble(uint64_t packed) {return packed & 0xFFFFFFFFu;}
+};
+
+// How far the tables reach from the "from" note, in notes: two periods (usually octaves) of the
+// scale in either direction, and at least the 14 notes that is for a diatonic scale
+inline int transitionReach(int notesPerOctave)
+{
+	return std::max(2 * notesPerOctave, 14);
+}
+
+// The voice assignment jumbleChord() would choose for every rollover within reach, for one set of
+// TransitionParams. The chord on a note is the chord on (note modulo the notes in an octave) shifted
+// by whole octaves, which doesn't change the jumble, so the table has a row for each note of an
+// octave, indexed by (to note - from note). In an equal division every note's chord is the same
+// shape, so one row does for all of them.
+// It assumes the "from" chord has its voices in sorted order, as it does after any steady chord.
+// The table is sized for its scale and chord size when it is built, so that the finest scales can
+// reach as far as the diatonic one. Rebuilding it only allocates if it has to grow.
+struct TransitionTable
+{
+	bool valid = false;
+	uint64_t params = 0;	// TransitionParams::Pack() of what the table was built for
+	int rows = 1;
+	int reach = 0;
+	int numNotes = 1;
+	std::vector<uint8_t> voiceTargets;	// [rows][2 * reach + 1][numNotes]
+
+	// scale must be the one with transitionParams.scaleId. Times each jumble into stats, and
+	// reports bypassed jumbles to diagnostics, if given.
+	void Build(const TransitionParams &transitionParams, const Scale &scale, JumbleWorkspace &workspace, JumbleStats *stats = NULL, DiagnosticChannel *diagnostics = NULL);
+
+	// Indices into the (sorted) chord on toNote for each voice, or NULL if out of reach
+	const uint8_t *Lookup(int fromNote, int toNote) const
+	{
+		int step = toNote - fromNote;
+		if( step < -reach || step > reach ) {
+			return NULL;
+		}
+		return &voiceTargets[(niceModulo(fromNote, rows) * (2 * reach + 1) + step + reach) * numNotes];
+	}
+};
+
+// Builds TransitionTables on a worker thread, so that the factorial-cost jumble search never
+// happens on the audio thread. The audio thread asks for a table with Request() whenever the
+// parameters change, and picks up the latest finished table with Latest().
+// Every builder shares the one worker (see TransitionTable.cpp), which sleeps until a request comes
+// and then builds each builder's latest request in turn. A builder is a request slot, the tables
+// and the stats; the worker has the JumbleWorkspace.
+// A synchronous builder has no worker, and builds the table inside Request() instead. That's no
+// good for audio, but the results don't depend on thread timing, which is what replaying a trace
+// needs.
+class TransitionTableBuilder
+{
+	private:
+		TripleBuffer<TransitionTable> m_tables;
+		std::unique_ptr<JumbleWorkspace> m_workspace;	// Only for a synchronous builder
+		bool m_synchronous;
+		std::atomic<uint64_t> m_requested;
+		std::atomic<const Scale*> m_requestedScale;	// Stored before m_requested, and checked against its scaleId
+		uint64_t m_lastRequested;					// Only used by the audio thread
+		bool m_wakePending;							// Likewise. The worker hasn't been woken for m_lastRequested yet.
+		uint64_t m_built;							// Only used by the worker
+		bool m_building;							// Guarded by the worker's mutex
+		JumbleStats m_stats;						// Written by the worker
+		DiagnosticChannel m_diagnostics;			// Likewise
+
+		friend class TransitionWorker;
+		// Returns false if the worker couldn't be woken without waiting, in which case Request() tries again
+		bool WakeWorker();
+		// Called by the worker. Builds the latest request, if it hasn't already.
+		void BuildRequested(JumbleWorkspace &workspace);
+	public:
+		// Registers with the shared worker (starting it if this is the only builder), so mustn't be
+		// called on the audio thread
+		explicit TransitionTableBuilder(bool synchronous = false);
+		// Waits for the worker to finish any table it is building for this builder
+		~TransitionTableBuilder();
+		const JumbleStats &Stats() const {return m_stats;}
+		// Called by the audio thread. Cheap when nothing has changed.
+		// The scale must outlive the builder, as the worker may still be using it.
+		void Request(const TransitionParams &params, const Scale &scale)
+		{
+			assert(params.scaleId == scale.Id());
+			if( m_wakePending ) {
+				m_wakePending = !WakeWorker();
+			}
+			uint64_t packed = params.Pack();
+			if( packed != m_lastRequested ) {
+				m_lastRequested = packed;
+				if( m_synchronous ) {
+					m_tables.Back().Build(params, scale, *m_workspace, &m_stats, &m_diagnostics);
+					m_tables.Publish();
+					return;
+				}
+				m_requestedScale.store(&scale);
+				m_requested.store(packed);
+				m_wakePending = !WakeWorker();
+			}
+		}
+		// Called by the audio thread. The latest table to be built, if it was built for params, or
+		// failing that for params with a different jumble amount. While the jumble is being swept, a
+		// table can be out of date by the time it is built, and a rollover is better jumbled a little
+		// off than not jumbled at all. A table for another key, mode, chord size or scale is no use.
+		const TransitionTable *Latest(const TransitionParams &params)
+		{
+			m_tables.Fetch();
+			const TransitionTable &table = m_tables.Front();
+			if( table.valid && TransitionParams::WithoutJumble(table.params) == TransitionParams::WithoutJumble(params.Pack()) ) {
+				return &table;
+			}
+			return NULL;
+		}
+};
@@ -1,8 +1,13 @@
 #include "plugin.hpp"
+#include "ChordCore.hpp"
 
 
 Plugin* pluginInstance;
 
+static void logToRack(const char* message) {
+	INFO("%s", message);
+}
+
 
 void init(Plugin* p) {
 	pluginInstance = p;
@@ -10,6 +15,9 @@ void init(Plugin* p) {
 	// Add modules here
 	p->addModel(modelChordRollover);
 
+	// Send the Rack-independent core's log messages to Rack's log
+	chordCoreLog = logToRack;
+
 	// Any other plugin initialization may go here.
 	// As an alternative, consider lazy-loading assets and lookup tables when your module is created to reduce startup times of Rack.
 }
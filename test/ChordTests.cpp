@@ -0,0 +1,925 @@
+// Checks of the Rack-independent core. Build and run with "make test".
+// The scale maths and the jumble invariants are checked exhaustively over every key sig, mode and
+// chord size, followed by a randomized property suite (pass a seed as the first argument to vary it).
+// Failures assert, so this must be built without NDEBUG.
+// "make test ALLOC_COUNTER=1" also counts the engine's heap allocations on the audio thread, which
+// must be none. That covers the engine only: Rack's side of process() (its logger, for one) isn't
+// built here, and needs the plugin's own ALLOC_COUNTER build running in Rack.
+
+#include "AllocCounter.hpp"
+#include "ChordCore.hpp"
+#include "ChordEngine.hpp"
+#include "ControlParams.hpp"
+#include "DiagnosticLog.hpp"
+#include "TraceRecorder.hpp"
+#include "TransitionTable.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+#ifdef NDEBUG
+#error "The tests use assert, so NDEBUG must not be defined"
+#endif
+
+static const float pleaseAvoidChange = 1.f / 12.f / 5.f;	// As jumblednessScore()
+
+static float changeStdDev(const ChordPitches &to, const ChordPitches &from)
+{
+	assert(to.size() == from.size());
+	ChordPitches change;
+	for( int i = 0; i < to.size(); i++ ) {
+		change.push_back(to[i] - from[i]);
+	}
+	float mean, stdDev;
+	meanStandardDeviation(change, mean, stdDev);
+	return stdDev;
+}
+
+static bool anyNoteUnchanged(const ChordPitches &to, const ChordPitches &from)
+{
+	for( int i = 0; i < from.size(); i++ ) {
+		if( std::abs(to[i] - from[i]) < pleaseAvoidChange ) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool isReordering(ChordPitches jumbled, ChordPitches original)
+{
+	std::sort(jumbled.begin(), jumbled.end());
+	std::sort(original.begin(), original.end());
+	return jumbled == original;
+}
+
+static void testVoltageToNearestSemi()
+{
+	for( int semi = -120; semi <= 120; semi++ ) {
+		assert(voltageToNearestSemi(semi / 12.f) == semi);
+		assert(voltageToNearestSemi((semi - 0.49f) / 12.f) == semi);
+		assert(voltageToNearestSemi((semi + 0.49f) / 12.f) == semi);
+	}
+}
+
+static void testKeyMode(int key, int mode)
+{
+	std::string modeString = generateModeString(mode);
+	for( int semi = 0; semi <= 11; semi++ ) {
+		bool outOfKey = false;
+		int note = semiToNoteWithinKeySig(semi, key, modeString, &outOfKey);
+		int semiCalc = noteToSemiWithinKeySig(note, key, modeString);
+		assert(semiCalc == semi || outOfKey);
+	}
+	// The compiled diatonic scale must agree with the reference functions, over the nine octaves
+	// either side of 0V that the reference functions search. Its steps are semis above the key sig.
+	const Scale &diatonic = builtInScale(DIATONIC_SCALE);
+	for( int semi = -108; semi <= 108; semi++ ) {
+		bool outOfKey = false;
+		bool outOfKeyTable = false;
+		int note = semiToNoteWithinKeySig(semi, key, modeString, &outOfKey);
+		assert(diatonic.Quantize(semi / 12.f, key, mode) == semi - key);
+		assert(diatonic.StepToNote(semi - key, mode, &outOfKeyTable) == note);
+		assert(outOfKeyTable == outOfKey);
+		assert(diatonic.OutOfKey(semi - key, mode) == outOfKey);
+		// An out of key semi belongs to the note just below it
+		assert(diatonic.NoteToStep(note, mode) + key == (outOfKey ? semi - 1 : semi));
+	}
+	for( int note = -63; note <= 63; note++ ) {
+		int semi = diatonic.NoteToStep(note, mode) + key;
+		assert(semi == noteToSemiWithinKeySig(note, key, modeString));
+		assert(diatonic.StepToVoltage(semi - key, key, mode) == semi / 12.f);
+		int step = diatonic.NoteToStep(note + 1, mode) + key - semi;
+		assert(step == 1 || step == 2);		// Every mode is diatonic
+		assert(diatonic.NoteToStep(note + 7, mode) + key == semi + 12);
+		assert(!diatonic.OutOfKey(semi - key, mode));
+	}
+}
+
+static void testScaleSpotChecks()
+{
+	bool outOfKey = false;
+	std::string modeString = generateModeString(0);
+	assert(semiToNoteWithinKeySig(0,0,modeString,&outOfKey)==0);	// C in C Major Ionian
+	assert(outOfKey==false);
+	assert(semiToNoteWithinKeySig(1,0,modeString,&outOfKey)==0);	// C# in C Major Ionian
+	assert(outOfKey==true);
+	assert(semiToNoteWithinKeySig(2,0,modeString,&outOfKey)==1);	// D in C Major Ionian
+	assert(outOfKey==false);
+	assert(semiToNoteWithinKeySig(9,11,modeString,&outOfKey)==5-7);	// A in B Major Ionian
+	assert(outOfKey==true);
+	modeString = generateModeString(1);
+	assert(semiToNoteWithinKeySig(9,11,modeString,&outOfKey)==6-7);	// A in B Dorian
+	assert(outOfKey==false);
+}
+
+// Scales other than the diatonic one: the other built-in scales, equal divisions and Scala files
+static void testOtherScales()
+{
+	// Aeolian is the harmonic minor, and mode 4 of the pentatonic scale the minor pentatonic
+	const int harmonicMinor[7] = {0, 2, 3, 5, 7, 8, 11};
+	for( int note = 0; note < 7; note++ ) {
+		assert(builtInScale(HARMONIC_MINOR_SCALE).NoteToStep(note, 5) == harmonicMinor[note]);
+	}
+	const int minorPentatonic[5] = {0, 3, 5, 7, 10};
+	const Scale &pentatonic = builtInScale(PENTATONIC_SCALE);
+	assert(pentatonic.NotesPerOctave() == 5);
+	for( int note = 0; note < 5; note++ ) {
+		assert(pentatonic.NoteToStep(note, 4) == minorPentatonic[note]);
+	}
+	bool outOfKey = false;
+	assert(pentatonic.StepToNote(6, 0, &outOfKey) == 2 && outOfKey);	// F# belongs to E in C
+
+	// Every step of an equal division is a note, at a pitch that quantizes back to it
+	for( int steps = 5; steps <= maxScaleSteps; steps++ ) {
+		std::unique_ptr<Scale> edo = Scale::EqualDivision(steps);
+		assert(edo->NotesPerOctave() == steps);
+		for( int step = -2 * steps; step <= 2 * steps; step++ ) {
+			float voltage = edo->StepToVoltage(step, 3, 2);
+			assert(edo->Quantize(voltage, 3, 2) == step);
+			assert(edo->Quantize(voltage + edo->ChangeThreshold() * 0.9f, 3, 2) == step);
+			assert(edo->StepToNote(step, 2, &outOfKey) == step && !outOfKey);
+		}
+	}
+
+	// Chords in scales of more than seven notes are stacked by pitch, not by two notes at a time:
+	// the major triad in 12-EDO, and likewise in finer EDOs (in 72-EDO, 0, 383 and 700 cents)
+	const int triads[3][4] = {{12, 4, 7}, {31, 10, 18}, {72, 23, 42}};
+	for( int i = 0; i < 3; i++ ) {
+		std::unique_ptr<Scale> edo = Scale::EqualDivision(triads[i][0]);
+		for( int root = -triads[i][0]; root <= triads[i][0]; root += 5 ) {
+			assert(edo->ChordDegree(root, 3, 1) == triads[i][1] && edo->ChordDegree(root, 3, 2) == triads[i][2]);
+			assert(edo->ChordDegree(root, 3, 4) == triads[i][0] + triads[i][1]);
+		}
+	}
+
+	// A Scala file of 12-EDO, in cents, is 12-EDO
+	std::string error;
+	std::unique_ptr<Scale> scala = Scale::FromScala("! 12tet.scl\n!\n12-TET\n 12\n!\n100.\n200.\n300.\n400.\n500.\n600.\n700.\n800.\n900.\n1000.\n1100.\n2/1\n", error);
+	assert(scala && error.empty());
+	std::unique_ptr<Scale> edo = Scale::EqualDivision(12);
+	for( int key = 0; key < 12; key++ ) {
+		for( int step = -24; step <= 24; step++ ) {
+			assert(std::abs(scala->StepToVoltage(step, key, 0) - edo->StepToVoltage(step, key, 0)) < 1e-5f);
+		}
+	}
+
+	// An unequal Scala tuning, with ratios, quantizes to the nearest step
+	scala = Scale::FromScala("Bohlen-Pierce just\n13\n27/25\n25/21\n9/7\n7/5\n75/49\n5/3\n9/5\n49/25\n15/7\n7/3\n63/25\n25/9\n3/1\n", error);
+	assert(scala && scala->StepsPerOctave() == 13 && scala->NotesPerOctave() == 13);
+	assert(std::abs(scala->StepToVoltage(13, 0, 0) - std::log2(3.f)) < 1e-5f);
+	for( int mode = 0; mode < numModes; mode++ ) {
+		for( int root = 0; root < 13; root++ ) {
+			// Its chords go up, and stay within the period
+			ChordPitches chord = chordPitchesForNote(root, *scala, 0, mode, 4);
+			assert(chord[0] < chord[1] && chord[1] < chord[2] && chord[2] < chord[3]);
+			assert(std::abs(chord[3] - chord[0] - std::log2(3.f)) < 1e-5f);
+		}
+	}
+	for( int mode = 0; mode < numModes; mode++ ) {
+		for( float voltage = -2.f; voltage <= 2.f; voltage += 0.001f ) {
+			int nearest = 0;
+			for( int step = -40; step <= 40; step++ ) {
+				if( std::abs(scala->StepToVoltage(step, 7, mode) - voltage) < std::abs(scala->StepToVoltage(nearest, 7, mode) - voltage) ) {
+					nearest = step;
+				}
+			}
+			int step = scala->Quantize(voltage, 7, mode);
+			float error = std::abs(scala->StepToVoltage(step, 7, mode) - voltage) - std::abs(scala->StepToVoltage(nearest, 7, mode) - voltage);
+			assert(step == nearest || error < 1e-5f);
+		}
+	}
+
+	// Text that isn't a scale
+	assert(!Scale::FromScala("", error) && !error.empty());
+	assert(!Scale::FromScala("Descending\n2\n700.\n500.\n", error));
+	assert(!Scale::FromScala("Too short\n3\n700.\n2/1\n", error));
+	assert(!Scale::FromScala("Not a pitch\n1\nfoo\n", error));
+
+	// Scales as traces describe them
+	std::unique_ptr<Scale> owned;
+	assert(scaleFromSpec("builtin:2", owned, error) == &builtInScale(PENTATONIC_SCALE));
+	assert(scaleFromSpec("edo:19", owned, error)->StepsPerOctave() == 19);
+	assert(scaleFromSpec("scala:Fifths\n1\n3/2\n", owned, error)->NotesPerOctave() == 1);
+	assert(!scaleFromSpec("edo:0", owned, error) && !scaleFromSpec("builtin:x", owned, error) && !scaleFromSpec("", owned, error));
+}
+
+static void testChords(const Scale &scale, int key, int mode)
+{
+	int notesPerOctave = scale.NotesPerOctave();
+	for( int numNotes = 1; numNotes <= maxChordNotes; numNotes++ ) {
+		for( int note = -14; note <= 14; note++ ) {
+			ChordPitches pitches = chordPitchesForNote(note, scale, key, mode, numNotes);
+			assert(pitches.size() == numNotes);
+			assert(std::is_sorted(pitches.begin(), pitches.end()));
+			for( int i = 0; i < numNotes; i++ ) {
+				assert(!scale.OutOfKey(scale.Quantize(pitches[i], key, mode), mode));
+			}
+			// A chord an octave up is the same chord, an octave up
+			ChordPitches octaveUp = chordPitchesForNote(note + notesPerOctave, scale, key, mode, numNotes);
+			for( int i = 0; i < numNotes; i++ ) {
+				assert(std::abs(octaveUp[i] - pitches[i] - 1.f) < 1e-5f);
+			}
+		}
+	}
+}
+
+// Every rollover that a transition table covers, for every chord size that tries every permutation
+static void testJumbleInvariants(const Scale &scale, int key, int mode, JumbleWorkspace &workspace)
+{
+	for( int numNotes = 1; numNotes <= maxExhaustiveJumbleNotes; numNotes++ ) {
+		int reach = transitionReach(scale.NotesPerOctave());
+		for( int fromNote = 0; fromNote < scale.NotesPerOctave(); fromNote++ ) {
+			ChordPitches fromPitches = chordPitchesForNote(fromNote, scale, key, mode, numNotes);
+			for( int toNote = fromNote - reach; toNote <= fromNote + reach; toNote++ ) {
+				ChordPitches toPitches = chordPitchesForNote(toNote, scale, key, mode, numNotes);
+
+				// Is there any mapping that moves every note?
+				bool anyAllowed = false;
+				int order[maxJumbleNotes];
+				for( int i = 0; i < numNotes; i++ ) {
+					order[i] = i;
+				}
+				do {
+					anyAllowed = !jumblednessScore(toPitches, order, fromPitches).PleaseAvoid();
+				} while( !anyAllowed && std::next_permutation(order, order + numNotes) );
+
+				// From a sorted chord, no jumble goes straight to the sorted chord
+				assert(jumbleChord(toPitches, fromPitches, 0.f, workspace) == toPitches);
+
+				float previousStdDev = -1.f;
+				for( int tenths = 1; tenths <= 10; tenths++ ) {
+					ChordPitches jumbled = jumbleChord(toPitches, fromPitches, tenths / 10.f, workspace);
+					assert(isReordering(jumbled, toPitches));
+					// Only when there is no alternative does a note stay where it is
+					assert(!anyAllowed || !anyNoteUnchanged(jumbled, fromPitches));
+					// More jumble never gives a less jumbled chord
+					float stdDev = changeStdDev(jumbled, fromPitches);
+					assert(stdDev >= previousStdDev - 1e-5f);
+					previousStdDev = stdDev;
+				}
+			}
+		}
+	}
+}
+
+static void testTransitionTable(const Scale &scale, int key, int mode, int numNotes, float jumbleAmount, JumbleWorkspace &workspace)
+{
+	std::unique_ptr<TransitionTable> table(new TransitionTable);
+	TransitionParams params = {key, mode, numNotes, jumbleAmount, scale.Id()};
+	table->Build(params, scale, workspace);
+	assert(table->valid && table->params == params.Pack());
+	for( int fromNote = -10; fromNote <= 10; fromNote++ ) {
+		for( int toNote = fromNote - table->reach; toNote <= fromNote + table->reach; toNote++ ) {
+			ChordPitches fromPitches = chordPitchesForNote(fromNote, scale, key, mode, numNotes);
+			ChordPitches toPitches = chordPitchesForNote(toNote, scale, key, mode, numNotes);
+			const uint8_t *voiceTargets = table->Lookup(fromNote, toNote);
+			assert(voiceTargets);
+			// Same as jumbling the chord directly, apart from the choice between mappings whose
+			// scores tie (which octave shifting can reorder through rounding)
+			ChordPitches jumbled = jumbleChord(toPitches, fromPitches, jumbleAmount, workspace);
+			ChordPitches tabled;
+			for( int i = 0; i < numNotes; i++ ) {
+				tabled.push_back(toPitches[voiceTargets[i]]);
+			}
+			assert(isReordering(tabled, toPitches));
+			assert(std::abs(changeStdDev(tabled, fromPitches) - changeStdDev(jumbled, fromPitches)) < 1e-3f);
+		}
+		assert(table->Lookup(fromNote, fromNote + table->reach + 1) == NULL);
+		assert(table->Lookup(fromNote, fromNote - table->reach - 1) == NULL);
+	}
+}
+
+// In fine scales the tables reach two octaves, so that rollovers of an octave or more are jumbled
+// like they are in the diatonic scale
+static void testFineScaleRollovers()
+{
+	const int divisions[2] = {31, 72};
+	for( int i = 0; i < 2; i++ ) {
+		std::unique_ptr<Scale> edo = Scale::EqualDivision(divisions[i]);
+		int octave = divisions[i];
+		ChordEngineSettings settings = {edo.get(), 0, 0, 3, 0.01f, 1.f, 1.f, LINEAR_GLIDE_CURVE, NO_STRUM, 0.f};
+		const float sampleTime = 1.f / 1000.f;
+		std::unique_ptr<ChordEngine> engine(new ChordEngine(true));
+		float voct[maxEngineVoices] = {};
+		float gate[maxEngineVoices] = {10.f};
+		for( int sample = 0; sample < 20; sample++ ) {
+			engine->Process(settings, voct, gate, 1, sampleTime);
+		}
+		for( int rollover = 1; rollover <= 2; rollover++ ) {
+			voct[0] = (float)rollover;
+			for( int sample = 0; sample < 20; sample++ ) {
+				engine->Process(settings, voct, gate, 1, sampleTime);
+			}
+			ChordExpanderMessage message;
+			engine->Publish(message);
+			bool jumbled = false;
+			for( int channel = 0; channel < 3; channel++ ) {
+				jumbled = jumbled || message.permutation[channel] != channel;
+				assert(message.degrees[channel] - rollover * octave == edo->ChordDegree(0, 0, message.permutation[channel]));
+			}
+			assert(jumbled);
+		}
+		std::unique_ptr<TransitionTable> table(new TransitionTable);
+		TransitionParams params = {0, 0, 3, 1.f, edo->Id()};
+		std::unique_ptr<JumbleWorkspace> workspace(new JumbleWorkspace);
+		table->Build(params, *edo, *workspace);
+		assert(table->rows == 1 && table->reach == 2 * octave);
+		assert(table->Lookup(5, 5 + 2 * octave) && table->Lookup(5, 5 - 2 * octave) && !table->Lookup(5, 6 + 2 * octave));
+	}
+}
+
+// Builders share one worker, which sleeps until there's a request. Every builder's table arrives,
+// however the requests land, and builders can come and go while it works.
+static void testSharedWorker()
+{
+	const Scale &scale = builtInScale(DIATONIC_SCALE);
+	const int numBuilders = 8;
+	std::unique_ptr<TransitionTableBuilder> builders[numBuilders];
+	TransitionParams params[numBuilders];
+	for( int round = 0; round < 3; round++ ) {
+		for( int i = 0; i < numBuilders; i++ ) {
+			if( !builders[i] || (i + round) % 3 == 0 ) {
+				builders[i].reset(new TransitionTableBuilder);
+			}
+			params[i] = {i % 12, (i + round) % 7, 1 + (i + round) % 5, i / 10.f, scale.Id()};
+		}
+		bool allReady = false;
+		for( int wait = 0; wait < 10000 && !allReady; wait++ ) {
+			allReady = true;
+			for( int i = 0; i < numBuilders; i++ ) {
+				// As the engine does every sample, which retries a wakeup that couldn't be made at once
+				builders[i]->Request(params[i], scale);
+				allReady = builders[i]->Latest(params[i]) != NULL && allReady;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		assert(allReady);
+	}
+
+	// While the jumble is swept, the table for the last amount stands in until the next is built.
+	// Moves within a step of the quantized amount don't ask for a new table.
+	std::unique_ptr<TransitionTableBuilder> builder(new TransitionTableBuilder);
+	TransitionParams sweep = {0, 0, 7, 0.3f, scale.Id()};
+	for( int wait = 0; wait < 10000 && !builder->Latest(sweep); wait++ ) {
+		builder->Request(sweep, scale);
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	for( int step = 0; step < 20; step++ ) {
+		sweep.jumbleAmount = TransitionParams::QuantizeJumble(0.3f + step * 0.0137f);
+		builder->Request(sweep, scale);
+		assert(builder->Latest(sweep) != NULL);
+	}
+	assert(TransitionParams::QuantizeJumble(0.3004f) == TransitionParams::QuantizeJumble(0.2996f));
+	TransitionParams otherSize = sweep;
+	otherSize.numNotes = 6;
+	assert(builder->Latest(otherSize) == NULL);
+}
+
+// The Hungarian algorithm against trying every assignment
+static void testMinCostAssignment(std::mt19937 &random)
+{
+	std::uniform_real_distribution<float> costs(0.f, 10.f);
+	for( int n = 1; n <= maxExhaustiveJumbleNotes; n++ ) {
+		for( int trial = 0; trial < 100; trial++ ) {
+			float cost[maxJumbleNotes][maxJumbleNotes];
+			for( int i = 0; i < n; i++ ) {
+				for( int j = 0; j < n; j++ ) {
+					// Some repeated costs, to exercise ties
+					cost[i][j] = (trial % 2) ? costs(random) : (float)(int)costs(random);
+				}
+			}
+			int assigned[maxJumbleNotes];
+			minCostAssignment(cost, n, assigned);
+			float assignedCost = 0.f;
+			bool targetUsed[maxJumbleNotes] = {};
+			for( int i = 0; i < n; i++ ) {
+				assert(assigned[i] >= 0 && assigned[i] < n && !targetUsed[assigned[i]]);
+				targetUsed[assigned[i]] = true;
+				assignedCost += cost[i][assigned[i]];
+			}
+			int order[maxJumbleNotes];
+			for( int i = 0; i < n; i++ ) {
+				order[i] = i;
+			}
+			float bestCost = 1e30f;
+			do {
+				float orderCost = 0.f;
+				for( int i = 0; i < n; i++ ) {
+					orderCost += cost[i][order[i]];
+				}
+				bestCost = std::min(bestCost, orderCost);
+			} while( std::next_permutation(order, order + n) );
+			assert(assignedCost <= bestCost + 1e-4f);
+		}
+	}
+}
+
+// Random chords, including ones too big to try every permutation of
+static void testRandomJumbles(std::mt19937 &random, JumbleWorkspace &workspace)
+{
+	std::uniform_int_distribution<int> semis(-24, 24);
+	std::uniform_int_distribution<int> sizes(1, maxChordNotes);
+	std::uniform_real_distribution<float> amounts(0.f, 1.f);
+	for( int trial = 0; trial < 2000; trial++ ) {
+		int numNotes = sizes(random);
+		ChordPitches fromPitches;
+		ChordPitches toPitches;
+		for( int i = 0; i < numNotes; i++ ) {
+			fromPitches.push_back(semis(random) / 12.f);
+			toPitches.push_back(semis(random) / 12.f);
+		}
+		float jumbleAmount = (trial % 4 == 0) ? 0.f : amounts(random);
+		ChordPitches jumbled = jumbleChord(toPitches, fromPitches, jumbleAmount, workspace);
+		assert(isReordering(jumbled, toPitches));
+		// Repeatable, which the transition tables rely on
+		assert(jumbleChord(toPitches, fromPitches, jumbleAmount, workspace) == jumbled);
+		if( jumbleAmount == 0.f ) {
+			// Nothing is less jumbled, apart from mappings that leave a note where it is
+			std::sort(toPitches.begin(), toPitches.end());
+			float stdDev = changeStdDev(jumbled, fromPitches);
+			bool avoidable = anyNoteUnchanged(jumbled, fromPitches);
+			for( int shuffle = 0; shuffle < 50; shuffle++ ) {
+				std::shuffle(toPitches.begin(), toPitches.end(), random);
+				if( avoidable || !anyNoteUnchanged(toPitches, fromPitches) ) {
+					assert(stdDev <= changeStdDev(toPitches, fromPitches) + 1e-4f);
+				}
+			}
+		}
+	}
+}
+
+// The baked glide curves against the curves themselves
+static void testGlideCurves()
+{
+	GlideCurveTable table;
+	for( int curve = 0; curve < NUM_GLIDE_CURVES; curve++ ) {
+		for( float profile = 1.f; profile <= 10.f; profile += 0.75f ) {
+			table.Update(curve, profile);
+			assert(table.Lookup(0.f) == 0.f && fabsf(table.Lookup(1.f) - 1.f) < 1e-6f);
+			float prev = 0.f;
+			for( int i = 0; i <= 1000; i++ ) {
+				float progress = i / 1000.f;
+				float y = table.Lookup(progress);
+				assert(y >= prev - 1e-6f);
+				prev = y;
+				if( curve == STEPPED_GLIDE_CURVE ) {
+					// Interpolation blurs the steps' edges, so only check between them
+					int steps = std::max(1, (int)std::round(profile));
+					float level = progress * (steps + 1);
+					if( fabsf(level - std::round(level)) * GlideCurveTable::tableSegments < 2.f * (steps + 1) ) {
+						continue;
+					}
+				}
+				assert(fabsf(y - glideCurve(curve, progress, quantizeGlideProfile(profile))) < 2e-3f);
+			}
+		}
+	}
+	// Profiles within a tenth share a table
+	assert(quantizeGlideProfile(2.96f) == quantizeGlideProfile(3.04f) && quantizeGlideProfile(0.f) == 1.f && quantizeGlideProfile(11.f) == 10.f);
+	table.Update(SIGMOID_GLIDE_CURVE, 2.96f);
+	assert(!table.Update(SIGMOID_GLIDE_CURVE, 3.04f) && table.Update(SIGMOID_GLIDE_CURVE, 3.06f));
+	// The sigmoid is the glide profile that the module has always had
+	table.Update(SIGMOID_GLIDE_CURVE, 3.f);
+	assert(fabsf(table.Lookup(0.3f) - glideProfile(0.3f, 3.f)) < 1e-4f);
+	assert(glideCurve(STEPPED_GLIDE_CURVE, 0.49f, 1.f) == 0.f && glideCurve(STEPPED_GLIDE_CURVE, 0.51f, 1.f) == 1.f);
+}
+
+// The knobs plus CVs, read at the control rate, and what changed since the last read
+static void testControlParams()
+{
+	ControlParams controls;
+	controls.SetInterval(4);
+	int due = 0;
+	for( int sample = 0; sample < 16; sample++ ) {
+		due += controls.Due();
+	}
+	assert(due == 4);
+
+	float knobs[NUM_ENGINE_PARAMS] = {11.f, 5.f, 4.f, 0.5f, 1.f, 0.f, LINEAR_GLIDE_CURVE, NO_STRUM, 0.5f};
+	float cvs[numControlInputs] = {};
+	assert(controls.Update(knobs, cvs) == (1u << NUM_ENGINE_PARAMS) - 1);
+	assert(controls.Update(knobs, cvs) == 0);
+
+	// The key wraps around the octave, and the other knobs stop at the ends of their ranges
+	cvs[KEYSIG_ENGINE_PARAM] = 2.f / 12.f;
+	cvs[MODE_ENGINE_PARAM] = 3.f;
+	cvs[CHORD_ENGINE_PARAM] = -10.f;
+	cvs[TIME_ENGINE_PARAM] = 1.f;
+	assert(controls.Update(knobs, cvs) == 0xF);
+	const float *values = controls.Values();
+	assert(values[KEYSIG_ENGINE_PARAM] == 1.f && values[MODE_ENGINE_PARAM] == 6.f && values[CHORD_ENGINE_PARAM] == 1.f);
+	assert(fabsf(values[TIME_ENGINE_PARAM] - 1.f) < 1e-6f);
+
+	// Noise within the thresholds is ignored, but not a move to the end of a range
+	cvs[TIME_ENGINE_PARAM] = 1.0005f;
+	cvs[JUMBLE_ENGINE_PARAM] = 0.005f;
+	assert(controls.Update(knobs, cvs) == 0);
+	cvs[JUMBLE_ENGINE_PARAM] = 0.02f;
+	assert(controls.Update(knobs, cvs) == 1u << JUMBLE_ENGINE_PARAM);
+	cvs[JUMBLE_ENGINE_PARAM] = 0.f;
+	assert(controls.Update(knobs, cvs) == 1u << JUMBLE_ENGINE_PARAM && controls.Values()[JUMBLE_ENGINE_PARAM] == 0.f);
+	knobs[CURVE_ENGINE_PARAM] = COSINE_GLIDE_CURVE;
+	assert(controls.Update(knobs, cvs) == 1u << CURVE_ENGINE_PARAM);
+
+	// A slow LFO sweeping the profile over its range changes it on a few of the control ticks, and
+	// switches glide curve table less often still (never rebaking one), yet still gets to the end
+	controls.SetInterval(defaultControlInterval);
+	GlideCurveTable table;
+	table.Update(SIGMOID_GLIDE_CURVE, controls.Values()[PROFILE_ENGINE_PARAM]);
+	const int ticks = 10 * 48000 / defaultControlInterval;
+	int profileChanges = 0;
+	int tableChanges = 0;
+	for( int tick = 0; tick <= ticks; tick++ ) {
+		cvs[PROFILE_ENGINE_PARAM] = 10.f * tick / ticks;
+		if( controls.Update(knobs, cvs) & (1u << PROFILE_ENGINE_PARAM) ) {
+			profileChanges++;
+			tableChanges += table.Update(SIGMOID_GLIDE_CURVE, controls.Values()[PROFILE_ENGINE_PARAM]);
+		}
+	}
+	assert(controls.Values()[PROFILE_ENGINE_PARAM] == 10.f);
+	assert(profileChanges < 200 && profileChanges * 100 < ticks);
+	assert(tableChanges == 9 * glideProfileSteps);
+}
+
+// A strum staggers when the notes of a rollover set off or arrive
+static void testStrum()
+{
+	const float sampleTime = 1.f / 1000.f;
+	const Scale &scale = builtInScale(DIATONIC_SCALE);
+	for( int strum = 0; strum < NUM_STRUM_MODES; strum++ ) {
+		// A triad gliding for 100 samples, with the notes staggered over half of that
+		ChordEngineSettings settings = {&scale, 0, 0, 3, 0.1f, 1.f, 0.f, LINEAR_GLIDE_CURVE, strum, 0.5f};
+		std::unique_ptr<ChordEngine> engine(new ChordEngine(true));
+		float voct[maxEngineVoices] = {};
+		float gate[maxEngineVoices] = {10.f};
+		engine->Process(settings, voct, gate, 1, sampleTime);
+		ChordPitches from = chordPitchesForNote(0, scale, 0, 0, 3);
+		ChordPitches to = chordPitchesForNote(1, scale, 0, 0, 3);
+		voct[0] = 2.f / 12.f;
+		float progress[100][3];
+		for( int sample = 0; sample < 100; sample++ ) {
+			engine->Process(settings, voct, gate, 1, sampleTime);
+			for( int i = 0; i < 3; i++ ) {
+				progress[sample][i] = (engine->pitchOutputs[i] - from[i]) / (to[i] - from[i]);
+			}
+		}
+		for( int i = 0; i < 3; i++ ) {
+			// Every note arrives by the end. Note i is the one at rank i for the upward strums.
+			assert(fabsf(progress[99][i] - 1.f) < 1e-4f);
+			int rank = (strum == STRUM_START_DOWN || strum == STRUM_ARRIVE_DOWN) ? 2 - i : i;
+			bool moving = progress[9][i] > 0.f;
+			bool arrived = progress[59][i] > 1.f - 1e-4f;
+			switch( strum ) {
+				case NO_STRUM:
+					assert(moving && !arrived && fabsf(progress[49][i] - 0.5f) < 1e-4f);
+					break;
+				case STRUM_START_UP:
+				case STRUM_START_DOWN:
+					// Setting off after 0, 25 and 50 samples, and taking 50
+					assert(moving == (rank == 0) && arrived == (rank == 0));
+					assert(fabsf(progress[rank * 25 + 24][i] - 0.5f) < 1e-4f);
+					break;
+				default:
+					// Arriving after 50, 75 and 100 samples
+					assert(moving && arrived == (rank == 0));
+					assert(fabsf(progress[rank * 25 + 49][i] - 1.f) < 1e-4f && progress[rank * 25 + 47][i] < 1.f);
+					break;
+			}
+		}
+	}
+}
+
+// Glides carry on from where they had got to when the glide time or the sample rate changes
+static void testGlideRetiming()
+{
+	const Scale &scale = builtInScale(DIATONIC_SCALE);
+	for( int retime = 0; retime < 2; retime++ ) {
+		// A single note gliding up a step over 100 samples, which after 50 either takes twice as long
+		// or runs at twice the sample rate, so that its second half takes 100 samples
+		ChordEngineSettings settings = {&scale, 0, 0, 1, 0.1f, 1.f, 0.f, LINEAR_GLIDE_CURVE, NO_STRUM, 0.f};
+		float sampleTime = 1.f / 1000.f;
+		std::unique_ptr<ChordEngine> engine(new ChordEngine(true));
+		float voct[maxEngineVoices] = {};
+		float gate[maxEngineVoices] = {10.f};
+		engine->Process(settings, voct, gate, 1, sampleTime);
+		voct[0] = 2.f / 12.f;
+		for( int sample = 0; sample < 50; sample++ ) {
+			engine->Process(settings, voct, gate, 1, sampleTime);
+		}
+		assert(fabsf(engine->pitchOutputs[0] - 1.f / 12.f) < 1e-5f);
+		if( retime == 0 ) {
+			settings.glideSeconds = 0.2f;
+		} else {
+			sampleTime /= 2.f;
+			engine->SetSampleTime(sampleTime);
+		}
+		for( int sample = 0; sample < 50; sample++ ) {
+			engine->Process(settings, voct, gate, 1, sampleTime);
+		}
+		assert(fabsf(engine->pitchOutputs[0] - 1.5f / 12.f) < 1e-5f);
+		for( int sample = 0; sample < 50; sample++ ) {
+			engine->Process(settings, voct, gate, 1, sampleTime);
+		}
+		assert(engine->pitchOutputs[0] == 2.f / 12.f && engine->rolloverBrightness > 0.f);
+		// The glide ends on the next sample, and the light goes out on the one after
+		engine->Process(settings, voct, gate, 1, sampleTime);
+		engine->Process(settings, voct, gate, 1, sampleTime);
+		assert(engine->rolloverBrightness == 0.f);
+	}
+}
+
+// Drives the engine with random knobs and inputs, checking what it outputs
+static void testRandomEngine(std::mt19937 &random)
+{
+	std::uniform_int_distribution<int> keys(0, 11);
+	std::uniform_int_distribution<int> modes(0, 6);
+	std::uniform_int_distribution<int> sizes(1, maxChordNotes);
+	std::uniform_int_distribution<int> voiceCounts(1, maxEngineVoices);
+	std::uniform_int_distribution<int> semis(-24, 24);
+	std::uniform_int_distribution<int> coin(0, 3);
+	std::uniform_int_distribution<int> curves(0, NUM_GLIDE_CURVES - 1);
+	std::uniform_int_distribution<int> strums(0, NUM_STRUM_MODES - 1);
+	const float sampleTime = 1.f / 48000.f;
+	float voct[maxEngineVoices] = {};
+	float gate[maxEngineVoices] = {};
+	for( int trial = 0; trial < 200; trial++ ) {
+		const Scale &scale = builtInScale(coin(random) == 0 ? PENTATONIC_SCALE : DIATONIC_SCALE);
+		ChordEngineSettings settings = {&scale, keys(random), modes(random), sizes(random), 0.001f, 1.f + coin(random) * 3.f, coin(random) / 3.f, curves(random), strums(random), coin(random) / 3.f};
+		int numVoices = voiceCounts(random);
+		int activeVoices = std::min(numVoices, maxChordNotes / settings.numNotes);
+		int glideSamples = (int)(settings.glideSeconds / sampleTime);
+		// Moving the knobs doesn't change a chord that is already playing, so each trial has a new engine
+		std::unique_ptr<ChordEngine> engine(new ChordEngine);
+		// Start every voice on a key in the key sig. (Until a voice has had one, it plays the chord on
+		// the key sig's root, and a later key at 0V wouldn't count as a change of pitch.)
+		for( int voice = 0; voice < numVoices; voice++ ) {
+			voct[voice] = scale.StepToVoltage(scale.NoteToStep(semis(random), settings.mode), settings.key, settings.mode);
+		}
+		for( int phrase = 0; phrase < 10; phrase++ ) {
+			// After the first phrase, change some voices' keys and gates. Hold them for longer than a glide.
+			for( int voice = 0; voice < numVoices && phrase > 0; voice++ ) {
+				if( coin(random) == 0 ) {
+					voct[voice] = semis(random) / 12.f;
+				}
+				if( coin(random) == 0 ) {
+					gate[voice] = gate[voice] > 0.f ? 0.f : 10.f;
+				}
+			}
+			for( int sample = 0; sample < glideSamples + 2; sample++ ) {
+				engine->Process(settings, voct, gate, numVoices, sampleTime);
+				assert(engine->NumVoices() == activeVoices);
+				assert(engine->outputChannels == activeVoices * settings.numNotes);
+				assert(engine->rolloverBrightness >= 0.f && engine->rolloverBrightness <= 1.f);
+				for( int channel = 0; channel < engine->outputChannels; channel++ ) {
+					assert(std::isfinite(engine->pitchOutputs[channel]));
+					float gateOutput = engine->gateOutputs[channel];
+					assert(gateOutput == gate[channel / settings.numNotes] || gateOutput == 0.f);
+				}
+			}
+			// Every glide has finished, so each voice that is on a key in the key sig plays its chord
+			for( int voice = 0; voice < activeVoices; voice++ ) {
+				int step = scale.Quantize(voct[voice], settings.key, settings.mode);
+				bool outOfKey = false;
+				int note = scale.StepToNote(step, settings.mode, &outOfKey);
+				if( outOfKey ) {
+					continue;
+				}
+				ChordPitches expected = chordPitchesForNote(note, scale, settings.key, settings.mode, settings.numNotes);
+				ChordPitches played;
+				for( int i = 0; i < settings.numNotes; i++ ) {
+					played.push_back(engine->pitchOutputs[voice * settings.numNotes + i]);
+				}
+				assert(isReordering(played, expected));
+			}
+			// What the expanders are told agrees with the outputs
+			ChordExpanderMessage message;
+			engine->Publish(message);
+			assert(message.outputChannels == engine->outputChannels && message.numNotes == settings.numNotes);
+			for( int channel = 0; channel < message.outputChannels; channel++ ) {
+				assert(message.glideProgress[channel] == 1.f && message.targetPitches[channel] == engine->pitchOutputs[channel]);
+				assert(message.permutation[channel] < settings.numNotes);
+				float degreePitch = scale.StepToVoltage(scale.NoteToStep(message.degrees[channel], settings.mode), settings.key, settings.mode);
+				assert(fabsf(degreePitch - message.targetPitches[channel]) < 1e-6f);
+			}
+		}
+	}
+}
+
+// Rollovers, jumble changes and expander messages make no heap allocations on the audio thread,
+// whether or not the worker has built the table yet (only counted with ALLOC_COUNTER=1)
+static void testNoAllocations()
+{
+	const Scale &scale = builtInScale(DIATONIC_SCALE);
+	ChordEngineSettings settings = {&scale, 0, 0, 4, 0.01f, 1.f, 0.5f, LINEAR_GLIDE_CURVE, NO_STRUM, 0.f};
+	const float sampleTime = 1.f / 48000.f;
+	std::unique_ptr<ChordEngine> engine(new ChordEngine);
+	ChordExpanderMessage message;
+	float voct[maxEngineVoices] = {};
+	float gate[maxEngineVoices] = {10.f, 10.f};
+	engine->Process(settings, voct, gate, 2, sampleTime);
+	AssertNoAllocations noAllocations;
+	for( int rollover = 0; rollover < 200; rollover++ ) {
+		voct[rollover % 2] = (rollover % 11 - 5) / 12.f;
+		if( rollover % 50 == 0 ) {
+			settings.jumbleAmount = rollover / 200.f;
+		}
+		for( int sample = 0; sample < 100; sample++ ) {
+			engine->Process(settings, voct, gate, 2, sampleTime);
+			engine->Publish(message);
+		}
+	}
+	assert(noAllocations.AllocationsSoFar() == 0);
+}
+
+// Everything pushed comes out once, in order, with the producer and consumer on different threads
+static void testSpscRing()
+{
+	const int count = 1000000;
+	SpscRing<int> ring(64);
+	std::thread producer([&]() {
+		for( int i = 0; i < count; ) {
+			if( int *slot = ring.BeginPush() ) {
+				*slot = i++;
+				ring.EndPush();
+			} else {
+				std::this_thread::yield();
+			}
+		}
+	});
+	for( int expected = 0; expected < count; ) {
+		if( const int *slot = ring.Front() ) {
+			assert(*slot == expected++);
+			ring.Pop();
+		} else {
+			std::this_thread::yield();
+		}
+	}
+	producer.join();
+	assert(!ring.Front());
+}
+
+// A recording read back from its file
+static void testTraceRecorder()
+{
+	const char *path = "ChordTests.crtrace";
+	const int samples = 5000;
+	std::unique_ptr<TraceRecorder> recorder(new TraceRecorder);
+	assert(!recorder->BeginFrame());
+	assert(recorder->Start(path, "builtin:0"));
+	for( int sample = 0; sample < samples; sample++ ) {
+		TraceFrame *frame = recorder->BeginFrame();
+		assert(frame);		// The ring is far bigger than this
+		frame->sampleTime = 1.f / 48000.f;
+		std::fill(frame->params, frame->params + traceParams, (float)sample);
+		frame->numVoices = 1 + sample % maxEngineVoices;
+		frame->outputChannels = sample % (maxChordNotes + 1);
+		std::fill(frame->voct, frame->voct + maxEngineVoices, sample / 12.f);
+		std::fill(frame->gate, frame->gate + maxEngineVoices, 10.f);
+		std::fill(frame->pitchOutputs, frame->pitchOutputs + maxChordNotes, -sample / 12.f);
+		std::fill(frame->gateOutputs, frame->gateOutputs + maxChordNotes, 0.f);
+		recorder->EndFrame();
+	}
+	recorder->Stop();
+	assert(!recorder->BeginFrame());
+	assert(recorder->Stats().framesWritten.Get() == samples && recorder->Stats().framesDropped.Get() == 0);
+
+	std::FILE *file = std::fopen(path, "rb");
+	assert(file);
+	TraceFileHeader header;
+	assert(std::fread(&header, sizeof(header), 1, file) == 1);
+	assert(std::memcmp(header.magic, traceMagic, sizeof(header.magic)) == 0 && header.version == traceVersion);
+	std::string scaleSpec(header.scaleSpecBytes, ' ');
+	assert(std::fread(&scaleSpec[0], 1, scaleSpec.size(), file) == scaleSpec.size() && scaleSpec == "builtin:0");
+	for( int sample = 0; sample < samples; sample++ ) {
+		TraceRecordHeader record;
+		assert(std::fread(&record, sizeof(record), 1, file) == 1);
+		assert(record.skippedSamples == 0 && record.params[traceParams - 1] == (float)sample);
+		assert(record.numVoices == 1 + sample % maxEngineVoices && record.outputChannels == sample % (maxChordNotes + 1));
+		std::vector<float> values(2 * (record.numVoices + record.outputChannels));
+		assert(std::fread(values.data(), sizeof(float), values.size(), file) == values.size());
+		assert(values[0] == sample / 12.f && values[record.numVoices] == 10.f);
+		assert(record.outputChannels == 0 || values[2 * record.numVoices] == -sample / 12.f);
+	}
+	assert(std::fgetc(file) == EOF);
+	std::fclose(file);
+	std::remove(path);
+}
+
+static std::mutex loggedMutex;
+static std::vector<std::string> logged;
+
+static void logToVector(const char* message)
+{
+	std::lock_guard<std::mutex> lock(loggedMutex);
+	logged.push_back(message);
+}
+
+// Diagnostics posted by a thread come out of chordCoreLog, rate limited
+static void testDiagnosticLog()
+{
+	chordCoreLog = logToVector;
+	{
+		DiagnosticChannel channel(0);
+		channel.Post(ROLLOVER_OUT_OF_REACH_EVENT, 3.f, 40.f);
+		channel.Post(TABLE_NOT_READY_EVENT, 4.f, 0.5f);
+	}
+	assert(logged.size() == 2);
+	assert(logged[0] == "ChordRollover: A rollover from note 3 to note 40 was beyond the jumble table, so it went to the sorted chord");
+	assert(logged[1].find("for 4 notes and jumble 0.50") != std::string::npos);
+
+	// Only the first of a burst is sent, and the rest are counted when the channel goes
+	logged.clear();
+	{
+		DiagnosticChannel channel(60000);
+		for( int i = 0; i < 10; i++ ) {
+			channel.Post(JUMBLE_BYPASSED_EVENT, (float)i, 203.f);
+		}
+	}
+	assert(logged.size() == 2);
+	assert(logged[0].find("for 0 of 203") != std::string::npos && logged[0].find("more like it") == std::string::npos);
+	assert(logged[1].find("for 9 of 203") != std::string::npos && logged[1].find("(8 more like it") != std::string::npos);
+
+	// A full ring drops diagnostics rather than waiting
+	logged.clear();
+	{
+		DiagnosticChannel channel(0);
+		for( int i = 0; i < 1000; i++ ) {
+			channel.Post(TABLE_NOT_READY_EVENT, 1.f, 0.f);
+		}
+		std::lock_guard<std::mutex> lock(loggedMutex);
+		assert(channel.Dropped() > 0);
+		assert(logged.size() + channel.Dropped() <= 1000);
+	}
+	chordCoreLog = [](const char* message) {};
+	logged.clear();
+}
+
+int main(int argc, char** argv)
+{
+	unsigned seed = argc > 1 ? (unsigned)strtoul(argv[1], NULL, 10) : 1;
+	std::unique_ptr<JumbleWorkspace> workspace(new JumbleWorkspace);
+
+	printf("Scale maths...\n");
+	testVoltageToNearestSemi();
+	testScaleSpotChecks();
+	for( int key = 0; key < 12; key++ ) {
+		for( int mode = 0; mode < 7; mode++ ) {
+			testKeyMode(key, mode);
+			for( int scale = 0; scale < NUM_BUILT_IN_SCALES; scale++ ) {
+				testChords(builtInScale(scale), key, mode);
+			}
+		}
+	}
+	testOtherScales();
+
+	printf("Jumble invariants...\n");
+	for( int mode = 0; mode < 7; mode++ ) {
+		// Jumbles only depend on the shape of the mode, not the key
+		testJumbleInvariants(builtInScale(DIATONIC_SCALE), mode, mode, *workspace);
+	}
+	testJumbleInvariants(builtInScale(PENTATONIC_SCALE), 0, 0, *workspace);
+
+	printf("Transition tables...\n");
+	for( int mode = 0; mode < 7; mode++ ) {
+		for( int numNotes = 1; numNotes <= maxExhaustiveJumbleNotes; numNotes++ ) {
+			testTransitionTable(builtInScale(DIATONIC_SCALE), 11 - mode, mode, numNotes, 0.f, *workspace);
+			testTransitionTable(builtInScale(DIATONIC_SCALE), 11 - mode, mode, numNotes, 0.6f, *workspace);
+		}
+	}
+	std::unique_ptr<Scale> edo = Scale::EqualDivision(19);
+	for( int numNotes = 1; numNotes <= maxExhaustiveJumbleNotes; numNotes++ ) {
+		testTransitionTable(builtInScale(PENTATONIC_SCALE), 4, 4, numNotes, 0.6f, *workspace);
+		testTransitionTable(*edo, 2, 1, numNotes, 0.6f, *workspace);
+	}
+	testFineScaleRollovers();
+	testSharedWorker();
+
+	printf("Glide curves...\n");
+	testGlideCurves();
+
+	printf("Control params...\n");
+	testControlParams();
+
+	printf("Trace recording and diagnostics...\n");
+	testSpscRing();
+	testDiagnosticLog();
+	testTraceRecorder();
+
+	printf("Randomized properties (seed %u)...\n", seed);
+	std::mt19937 random(seed);
+	testMinCostAssignment(random);
+	testRandomJumbles(random, *workspace);
+	testStrum();
+	testGlideRetiming();
+	testRandomEngine(random);
+	testNoAllocations();
+
+	printf("All tests passed\n");
+	return 0;
+}
@@ -0,0 +1,562 @@
+// Offline rendering of chord progressions through the same ChordEngine as the module, without Rack,
+// for making reference material and test fixtures faster than real time. Build with "make render".
+//
+//   ChordRender <events> <output> [setting=value...]
+//       Plays the events (a .csv or .mid file) into the engine, and writes its polyphonic pitch and
+//       gate outputs to output: a .wav file, or a .csv file ("-" for CSV to stdout).
+//
+// Settings:
+//   key, mode, notes, time, profile, jumble, curve, strum, spread
+//       The module's knobs and context menu settings (as the numbers the module saves), clamped to
+//       their ranges as the module's CV inputs are. By default, as the module's defaults.
+//   scale=builtin:<n>|edo:<steps>|scl:<path>
+//       A built-in scale (a BuiltInScale), an equal division of the octave, or a Scala file.
+//   rate=<Hz>        The sample rate (48000 by default).
+//   voices=<n>       For CSV events, the number of voices (1 by default). MIDI events have a voice per MIDI channel used.
+//   tail=<seconds>   How long to carry on after the last event (1 by default).
+//   seconds=<length> Render exactly this long instead, ignoring later events.
+//
+// CSV events are lines of "seconds,voice,voct,gate", in time order: from that time on, the voice's
+// V/Oct and gate inputs are voct and gate (volts). Lines that don't start with a number (a header,
+// or comments) are skipped. They are read as the render goes, so can be any length.
+//
+// MIDI files (format 0 or 1, with ticks per quarter note) are read into memory. Each MIDI channel
+// drives a voice, as a mono, legato MIDI to CV converter would: the last note held sets the pitch
+// (middle C at 0V), the gate is 10V while any note is held, and a note played while another is
+// held is a rollover.
+//
+// Output is written a block at a time, so a render of any length runs in constant memory.
+// WAV files are 32-bit float, one channel per output in volts: the pitch outputs, then the gate
+// outputs. Renders of over 4GB are written as RF64. CSV files have a header line, then a line per
+// sample of its time and the same channels. Renders use synchronous jumbles, like ChordReplay, so
+// their outputs don't depend on thread timing.
+
+#include "ChordEngine.hpp"
+#include "ControlParams.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static const int blockSamples = 4096;
+
+// From this time on, the voice's inputs are these voltages
+struct RenderEvent
+{
+	double seconds;
+	int voice;
+	float voct;
+	float gate;
+};
+
+class EventSource
+{
+	public:
+		virtual ~EventSource() {}
+		// Returns false at the end of the events, or with error set if they can't be read
+		virtual bool Next(RenderEvent &event, std::string &error) = 0;
+		virtual int Voices() const = 0;
+};
+
+// CSV events, read a line at a time
+class CsvEvents : public EventSource
+{
+	private:
+		std::FILE *m_file;
+		int m_voices;
+		unsigned long long m_line;
+	public:
+		CsvEvents(std::FILE *file, int voices) : m_file(file), m_voices(voices), m_line(0) {}
+		~CsvEvents() {std::fclose(m_file);}
+
+		bool Next(RenderEvent &event, std::string &error) override
+		{
+			char line[256];
+			while( std::fgets(line, sizeof(line), m_file) ) {
+				m_line++;
+				char *end = line;
+				event.seconds = std::strtod(line, &end);
+				if( end == line ) {
+					continue;	// Not an event
+				}
+				if( std::sscanf(end, " , %d , %f , %f", &event.voice, &event.voct, &event.gate) != 3 ) {
+					error = "Line " + std::to_string(m_line) + " isn't seconds,voice,voct,gate";
+					return false;
+				}
+				if( event.voice < 0 || event.voice >= m_voices ) {
+					error = "Line " + std::to_string(m_line) + " is for voice " + std::to_string(event.voice) + ", but voices=" + std::to_string(m_voices);
+					return false;
+				}
+				return true;
+			}
+			return false;
+		}
+		int Voices() const override {return m_voices;}
+};
+
+// The notes of a standard MIDI file, turned into a mono legato voice per MIDI channel
+class MidiEvents : public EventSource
+{
+	private:
+		std::vector<RenderEvent> m_events;
+		size_t m_next;
+		int m_voices;
+
+		struct Note
+		{
+			uint64_t tick;
+			int order;		// Within the file, to keep events at the same tick in order
+			int channel;
+			int key;
+			bool on;
+			uint32_t tempo;	// For tempo changes, in microseconds per quarter note (channel is -1)
+		};
+
+		static uint32_t bigEndian(const uint8_t *bytes, int count)
+		{
+			uint32_t value = 0;
+			for( int i = 0; i < count; i++ ) {
+				value = (value << 8) | bytes[i];
+			}
+			return value;
+		}
+
+		// Reads a track's notes and tempo changes, returning false if it is malformed
+		static bool readTrack(const uint8_t *data, const uint8_t *end, std::vector<Note> &notes)
+		{
+			uint64_t tick = 0;
+			uint8_t status = 0;
+			while( data < end ) {
+				uint32_t delta = 0;
+				do {
+					delta = (delta << 7) | (*data & 0x7f);
+				} while( (*data++ & 0x80) && data < end );
+				tick += delta;
+				if( data >= end ) {
+					return false;
+				}
+				if( *data & 0x80 ) {
+					status = *data++;
+				}
+				if( status == 0xff || status == 0xf0 || status == 0xf7 ) {
+					// Meta or sysex: a length, then that many bytes. Only tempo changes matter here.
+					uint8_t type = status == 0xff && data < end ? *data++ : 0;
+					uint32_t length = 0;
+					do {
+						if( data >= end ) {
+							return false;
+						}
+						length = (length << 7) | (*data & 0x7f);
+					} while( *data++ & 0x80 );
+					if( (size_t)(end - data) < length ) {
+						return false;
+					}
+					if( status == 0xff && type == 0x51 && length == 3 ) {
+						notes.push_back({tick, (int)notes.size(), -1, 0, false, bigEndian(data, 3)});
+					}
+					data += length;
+					status = 0;		// Running status doesn't carry past these
+					continue;
+				}
+				int kind = status >> 4;
+				int dataBytes = (kind == 0xc || kind == 0xd) ? 1 : 2;
+				if( kind < 0x8 || kind == 0xf || (size_t)(end - data) < (size_t)dataBytes ) {
+					return false;
+				}
+				if( kind == 0x8 || kind == 0x9 ) {
+					// A note on with velocity 0 is a note off
+					bool on = (kind == 0x9 && data[1] > 0);
+					notes.push_back({tick, (int)notes.size(), status & 0xf, data[0], on, 0});
+				}
+				data += dataBytes;
+			}
+			return true;
+		}
+
+	public:
+		MidiEvents() : m_next(0), m_voices(1) {}
+
+		// Returns false, with a description of the problem in error, if data isn't a usable MIDI file
+		bool Parse(const std::string &file, std::string &error)
+		{
+			const uint8_t *data = (const uint8_t*)file.data();
+			const uint8_t *end = data + file.size();
+			if( file.size() < 14 || std::memcmp(data, "MThd", 4) != 0 || bigEndian(data + 4, 4) < 6 || bigEndian(data + 4, 4) > file.size() - 8 ) {
+				error = "Not a MIDI file";
+				return false;
+			}
+			int format = bigEndian(data + 8, 2);
+			int tracks = bigEndian(data + 10, 2);
+			int division = bigEndian(data + 12, 2);
+			if( format > 1 || (division & 0x8000) || division == 0 ) {
+				error = "Only MIDI files of format 0 or 1, timed in ticks per quarter note, are supported";
+				return false;
+			}
+			data += 8 + bigEndian(data + 4, 4);
+			std::vector<Note> notes;
+			for( int track = 0; track < tracks && data + 8 <= end; track++ ) {
+				uint32_t length = bigEndian(data + 4, 4);
+				if( (size_t)(end - data - 8) < length ) {
+					error = "The MIDI file is truncated";
+					return false;
+				}
+				if( std::memcmp(data, "MTrk", 4) == 0 && !readTrack(data + 8, data + 8 + length, notes) ) {
+					error = "Track " + std::to_string(track) + " of the MIDI file is malformed";
+					return false;
+				}
+				data += 8 + length;
+			}
+			std::sort(notes.begin(), notes.end(), [](const Note &a, const Note &b) {
+				return a.tick != b.tick ? a.tick < b.tick : a.order < b.order;
+			});
+
+			// Play the notes through a converter per channel, following the tempo (120bpm until it's set)
+			std::vector<int> held[16];
+			double seconds = 0.0;
+			double secondsPerTick = 0.5 / division;
+			uint64_t tick = 0;
+			m_voices = 1;
+			for( const Note &note : notes ) {
+				seconds += (note.tick - tick) * secondsPerTick;
+				tick = note.tick;
+				if( note.channel < 0 ) {
+					secondsPerTick = note.tempo * 1e-6 / division;
+					continue;
+				}
+				std::vector<int> &keys = held[note.channel];
+				keys.erase(std::remove(keys.begin(), keys.end(), note.key), keys.end());
+				if( note.on ) {
+					keys.push_back(note.key);
+				}
+				float voct = keys.empty() ? (note.key - 60) / 12.f : (keys.back() - 60) / 12.f;
+				m_events.push_back({seconds, note.channel, voct, keys.empty() ? 0.f : 10.f});
+				m_voices = std::max(m_voices, note.channel + 1);
+			}
+			return true;
+		}
+
+		bool Next(RenderEvent &event, std::string &error) override
+		{
+			if( m_next == m_events.size() ) {
+				return false;
+			}
+			event = m_events[m_next++];
+			return true;
+		}
+		int Voices() const override {return m_voices;}
+};
+
+// Writes the outputs as they are rendered
+class OutputWriter
+{
+	public:
+		virtual ~OutputWriter() {}
+		// Writes frames frames of channels interleaved values
+		virtual bool Write(const float *values, int frames) = 0;
+		// Finishes the file, returning false if it couldn't be written
+		virtual bool Close() = 0;
+};
+
+// 32-bit float WAV (WAVE_FORMAT_EXTENSIBLE), with a JUNK chunk that becomes the ds64 chunk of an
+// RF64 file if the data outgrows the 32-bit sizes. The sizes are filled in by Close().
+// Like traces, the samples are written in the host's byte order, which must be little endian.
+class WavWriter : public OutputWriter
+{
+	private:
+		std::FILE *m_file;
+		int m_channels;
+		int m_sampleRate;
+		uint64_t m_frames;
+
+		void put(uint32_t value, int bytes)
+		{
+			for( int i = 0; i < bytes; i++ ) {
+				std::fputc((value >> (8 * i)) & 0xff, m_file);
+			}
+		}
+		void put64(uint64_t value)
+		{
+			put((uint32_t)value, 4);
+			put((uint32_t)(value >> 32), 4);
+		}
+		// The header, with sizes for m_frames frames
+		void writeHeader()
+		{
+			uint64_t dataBytes = m_frames * m_channels * sizeof(float);
+			const uint64_t headerBytes = 12 + 36 + 48 + 12 + 8;	// RIFF, JUNK/ds64, fmt, fact and data headers
+			uint64_t riffBytes = headerBytes - 8 + dataBytes;
+			bool rf64 = riffBytes > 0xffffffffull;
+			std::fwrite(rf64 ? "RF64" : "RIFF", 1, 4, m_file);
+			put(rf64 ? 0xffffffff : (uint32_t)riffBytes, 4);
+			std::fwrite("WAVE", 1, 4, m_file);
+			std::fwrite(rf64 ? "ds64" : "JUNK", 1, 4, m_file);
+			put(28, 4);
+			put64(rf64 ? riffBytes : 0);
+			put64(rf64 ? dataBytes : 0);
+			put64(rf64 ? m_frames : 0);
+			put(0, 4);
+			std::fwrite("fmt ", 1, 4, m_file);
+			put(40, 4);
+			put(0xfffe, 2);								// WAVE_FORMAT_EXTENSIBLE
+			put(m_channels, 2);
+			put(m_sampleRate, 4);
+			put(m_sampleRate * m_channels * 4, 4);		// Bytes per second
+			put(m_channels * 4, 2);						// Bytes per frame
+			put(32, 2);									// Bits per sample
+			put(22, 2);
+			put(32, 2);									// Valid bits
+			put(0, 4);									// No speaker positions
+			static const uint8_t floatFormat[16] = {0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71};
+			std::fwrite(floatFormat, 1, sizeof(floatFormat), m_file);
+			std::fwrite("fact", 1, 4, m_file);
+			put(4, 4);
+			put(rf64 ? 0xffffffff : (uint32_t)m_frames, 4);
+			std::fwrite("data", 1, 4, m_file);
+			put(rf64 ? 0xffffffff : (uint32_t)dataBytes, 4);
+		}
+	public:
+		WavWriter(std::FILE *file, int channels, int sampleRate)
+		: m_file(file), m_channels(channels), m_sampleRate(sampleRate), m_frames(0)
+		{
+			writeHeader();
+		}
+		~WavWriter() {if( m_file ) std::fclose(m_file);}
+
+		bool Write(const float *values, int frames) override
+		{
+			m_frames += frames;
+			return std::fwrite(values, sizeof(float) * m_channels, frames, m_file) == (size_t)frames;
+		}
+		bool Close() override
+		{
+			bool ok = std::fseek(m_file, 0, SEEK_SET) == 0;
+			if( ok ) {
+				writeHeader();
+			}
+			ok = (std::fclose(m_file) == 0) && ok;
+			m_file = NULL;
+			return ok;
+		}
+};
+
+class CsvWriter : public OutputWriter
+{
+	private:
+		std::FILE *m_file;
+		int m_channels;
+		double m_sampleTime;
+		uint64_t m_frames;
+	public:
+		CsvWriter(std::FILE *file, int outputChannels, double sampleTime)
+		: m_file(file), m_channels(2 * outputChannels), m_sampleTime(sampleTime), m_frames(0)
+		{
+			std::fprintf(m_file, "seconds");
+			for( int channel = 0; channel < outputChannels; channel++ ) {
+				std::fprintf(m_file, ",pitch%d", channel + 1);
+			}
+			for( int channel = 0; channel < outputChannels; channel++ ) {
+				std::fprintf(m_file, ",gate%d", channel + 1);
+			}
+			std::fprintf(m_file, "\n");
+		}
+		~CsvWriter() {if( m_file && m_file != stdout ) std::fclose(m_file);}
+
+		bool Write(const float *values, int frames) override
+		{
+			for( int frame = 0; frame < frames; frame++, m_frames++ ) {
+				std::fprintf(m_file, "%.9g", m_frames * m_sampleTime);
+				for( int channel = 0; channel < m_channels; channel++ ) {
+					std::fprintf(m_file, ",%.9g", values[frame * m_channels + channel]);
+				}
+				std::fprintf(m_file, "\n");
+			}
+			return !std::ferror(m_file);
+		}
+		bool Close() override
+		{
+			bool ok = m_file == stdout ? std::fflush(m_file) == 0 : std::fclose(m_file) == 0;
+			m_file = NULL;
+			return ok;
+		}
+};
+
+static int fail(const std::string &message)
+{
+	fprintf(stderr, "ChordRender: %s\n", message.c_str());
+	return 1;
+}
+
+static bool endsWith(const std::string &text, const std::string &suffix)
+{
+	return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static bool readFile(const std::string &path, std::string &contents)
+{
+	std::ifstream file(path, std::ios::binary);
+	std::stringstream text;
+	text << file.rdbuf();
+	contents = text.str();
+	return file.good() || file.eof();
+}
+
+int main(int argc, char** argv)
+{
+	if( argc < 3 ) {
+		fprintf(stderr,
+			"Usage: ChordRender <events.csv|events.mid> <output.wav|output.csv|-> [setting=value...]\n"
+			"Settings: key mode notes time profile jumble curve strum spread (as the module's knobs),\n"
+			"          scale=builtin:<n>|edo:<steps>|scl:<path>, rate=<Hz>, voices=<n> (CSV events),\n"
+			"          tail=<seconds>, seconds=<length>\n");
+		return 2;
+	}
+	std::string eventsPath = argv[1];
+	std::string outputPath = argv[2];
+
+	// The module's defaults
+	float knobs[NUM_ENGINE_PARAMS] = {0.f, 0.f, 4.f, 0.5f, 1.f, 0.f, SIGMOID_GLIDE_CURVE, NO_STRUM, 0.5f};
+	static const char *paramNames[NUM_ENGINE_PARAMS] = {"key", "mode", "notes", "time", "profile", "jumble", "curve", "strum", "spread"};
+	std::string scaleSpec = "builtin:0";
+	int sampleRate = 48000;
+	int csvVoices = 1;
+	double tailSeconds = 1.0;
+	double fixedSeconds = -1.0;
+	for( int arg = 3; arg < argc; arg++ ) {
+		std::string setting = argv[arg];
+		size_t equals = setting.find('=');
+		std::string name = setting.substr(0, equals);
+		std::string value = equals == std::string::npos ? "" : setting.substr(equals + 1);
+		int param = 0;
+		while( param < NUM_ENGINE_PARAMS && name != paramNames[param] ) {
+			param++;
+		}
+		if( value.empty() ) {
+			return fail("Expected setting=value, not \"" + setting + "\"");
+		} else if( param < NUM_ENGINE_PARAMS ) {
+			knobs[param] = (float)atof(value.c_str());
+		} else if( name == "scale" ) {
+			scaleSpec = value;
+		} else if( name == "rate" ) {
+			sampleRate = atoi(value.c_str());
+		} else if( name == "voices" ) {
+			csvVoices = atoi(value.c_str());
+		} else if( name == "tail" ) {
+			tailSeconds = std::max(atof(value.c_str()), 0.0);
+		} else if( name == "seconds" ) {
+			fixedSeconds = std::max(atof(value.c_str()), 0.0);
+		} else {
+			return fail("Unknown setting \"" + name + "\"");
+		}
+	}
+	if( sampleRate < 1 || csvVoices < 1 || csvVoices > maxEngineVoices ) {
+		return fail("rate must be positive, and voices from 1 to " + std::to_string(maxEngineVoices));
+	}
+
+	// The scale, as the module describes it in traces, apart from Scala files being read from a path
+	std::string error;
+	if( scaleSpec.compare(0, 4, "scl:") == 0 ) {
+		std::string text;
+		if( !readFile(scaleSpec.substr(4), text) ) {
+			return fail("Can't read " + scaleSpec.substr(4));
+		}
+		scaleSpec = "scala:" + text;
+	}
+	std::unique_ptr<Scale> ownedScale;
+	const Scale *scale = scaleFromSpec(scaleSpec, ownedScale, error);
+	if( !scale ) {
+		return fail(error);
+	}
+
+	// The knobs, as the module would take them
+	ControlParams controls;
+	float cvs[numControlInputs] = {};
+	controls.Update(knobs, cvs);
+	ChordEngineSettings settings = ChordEngineSettings::FromParams(scale, controls.Values());
+
+	std::unique_ptr<EventSource> events;
+	if( endsWith(eventsPath, ".mid") || endsWith(eventsPath, ".midi") ) {
+		std::string file;
+		std::unique_ptr<MidiEvents> midi(new MidiEvents);
+		if( !readFile(eventsPath, file) || !midi->Parse(file, error) ) {
+			return fail(eventsPath + ": " + (error.empty() ? "Can't read it" : error));
+		}
+		events = std::move(midi);
+	} else {
+		std::FILE *file = std::fopen(eventsPath.c_str(), "r");
+		if( !file ) {
+			return fail("Can't read " + eventsPath);
+		}
+		events.reset(new CsvEvents(file, csvVoices));
+	}
+
+	// As many voices as there are output channels for, as in ChordEngine::Process()
+	int numVoices = std::max(1, std::min(events->Voices(), maxChordNotes / settings.numNotes));
+	int outputChannels = numVoices * settings.numNotes;
+	double sampleTime = 1.0 / sampleRate;
+	std::unique_ptr<OutputWriter> writer;
+	std::FILE *outputFile = outputPath == "-" ? stdout : std::fopen(outputPath.c_str(), "wb");
+	if( !outputFile ) {
+		return fail("Can't write " + outputPath);
+	}
+	if( endsWith(outputPath, ".wav") ) {
+		writer.reset(new WavWriter(outputFile, 2 * outputChannels, sampleRate));
+	} else {
+		writer.reset(new CsvWriter(outputFile, outputChannels, sampleTime));
+	}
+
+	// Render a block at a time, applying each event at the first sample at or after its time
+	std::unique_ptr<ChordEngine> engine(new ChordEngine(true));
+	float voct[maxEngineVoices] = {};
+	float gate[maxEngineVoices] = {};
+	std::vector<float> block(blockSamples * 2 * outputChannels);
+	RenderEvent event;
+	bool pending = events->Next(event, error);
+	double lastEventSeconds = 0.0;
+	uint64_t endSample = fixedSeconds >= 0.0 ? (uint64_t)(fixedSeconds * sampleRate + 0.5) : UINT64_MAX;
+	uint64_t sample = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	while( sample < endSample && error.empty() ) {
+		int frames = 0;
+		for( ; frames < blockSamples && sample < endSample && error.empty(); frames++, sample++ ) {
+			double now = sample * sampleTime;
+			while( pending && event.seconds <= now ) {
+				if( event.seconds < lastEventSeconds ) {
+					error = "The events aren't in time order";
+					break;
+				}
+				lastEventSeconds = event.seconds;
+				voct[event.voice] = event.voct;
+				gate[event.voice] = event.gate;
+				pending = events->Next(event, error);
+			}
+			if( !pending && fixedSeconds < 0.0 && endSample == UINT64_MAX ) {
+				// The events have run out, so finish after the tail
+				endSample = std::max((uint64_t)((lastEventSeconds + tailSeconds) * sampleRate + 0.5), sample + 1);
+			}
+			engine->Process(settings, voct, gate, numVoices, (float)sampleTime);
+			float *values = block.data() + frames * 2 * outputChannels;
+			std::copy(engine->pitchOutputs, engine->pitchOutputs + outputChannels, values);
+			std::copy(engine->gateOutputs, engine->gateOutputs + outputChannels, values + outputChannels);
+		}
+		if( !writer->Write(block.data(), frames) ) {
+			error = "Can't write " + outputPath;
+		}
+	}
+	if( !error.empty() ) {
+		return fail(error);
+	}
+	if( !writer->Close() ) {
+		return fail("Can't finish writing " + outputPath);
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	fprintf(stderr, "Rendered %.1f seconds (%llu samples, %d channels) in %.2f seconds, %.0fx real time\n",
+		sample * sampleTime, (unsigned long long)sample, outputChannels, seconds, sample * sampleTime / std::max(seconds, 1e-9));
+	return 0;
+}
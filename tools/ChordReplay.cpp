@@ -0,0 +1,341 @@
+// Headless replay of ChordRollover traces (see TraceRecorder.hpp), through the same ChordEngine as
+// the module, without Rack. Build with "make replay".
+//
+//   ChordReplay compare <trace> [tolerance]
+//       Replays the trace's inputs and knobs, and checks that every sample's outputs match the
+//       ones in the trace, to within tolerance volts (0, the default, for bit-for-bit).
+//   ChordReplay golden <trace> <new trace>
+//       Replays the trace, writing its inputs and knobs with this build's outputs to the new trace.
+//   ChordReplay synthesize <new trace> <samples> [seed]
+//       Writes a trace of random rollovers, knob changes and gates, with this build's outputs.
+//   ChordReplay throughput <trace> [repeats]
+//       Replays the trace repeats times (1 by default), and reports samples per second.
+//
+// Replays work out jumbles synchronously, so their outputs don't depend on thread timing. A trace
+// recorded in Rack, where the jumbles are worked out on a worker thread, can differ from its replay
+// for rollovers made just after a knob moved, before the worker caught up. So for regression
+// testing, make a golden trace with "golden" or "synthesize" before a change, and "compare" after.
+// Traces are memory mapped, so this needs POSIX.
+
+#include "ChordEngine.hpp"
+#include "TraceRecorder.hpp"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A trace file mapped into memory, read one record at a time
+class MappedTrace
+{
+	private:
+		const char *m_data = NULL;
+		size_t m_size = 0;
+		size_t m_firstRecord = 0;
+		size_t m_position = 0;
+		std::string m_scaleSpec;
+	public:
+		~MappedTrace()
+		{
+			if( m_data ) {
+				munmap((void*)m_data, m_size);
+			}
+		}
+
+		// Returns false, with a description of the problem in error, if path isn't a trace
+		bool Open(const char *path, std::string &error)
+		{
+			int fd = open(path, O_RDONLY);
+			if( fd < 0 ) {
+				error = std::string("Can't open ") + path;
+				return false;
+			}
+			struct stat status;
+			fstat(fd, &status);
+			m_size = (size_t)status.st_size;
+			TraceFileHeader header;
+			if( m_size >= sizeof(header) ) {
+				void *data = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+				m_data = data == MAP_FAILED ? NULL : (const char*)data;
+			}
+			close(fd);
+			if( !m_data ) {
+				error = std::string("Can't map ") + path;
+				return false;
+			}
+			madvise((void*)m_data, m_size, MADV_SEQUENTIAL);
+			std::memcpy(&header, m_data, sizeof(header));
+			if( std::memcmp(header.magic, traceMagic, sizeof(header.magic)) != 0 || header.version != traceVersion ) {
+				error = std::string(path) + " isn't a version " + std::to_string(traceVersion) + " trace";
+				return false;
+			}
+			if( m_size < sizeof(header) + header.scaleSpecBytes ) {
+				error = std::string(path) + " is truncated";
+				return false;
+			}
+			m_scaleSpec.assign(m_data + sizeof(header), header.scaleSpecBytes);
+			m_firstRecord = sizeof(header) + header.scaleSpecBytes;
+			Rewind();
+			return true;
+		}
+
+		const std::string &ScaleSpec() const {return m_scaleSpec;}
+		void Rewind() {m_position = m_firstRecord;}
+
+		// Reads the next record into frame (apart from its session and sample), returning false at
+		// the end of the trace, or if the last record is truncated
+		bool Next(TraceFrame &frame, uint32_t &skippedSamples)
+		{
+			TraceRecordHeader record;
+			if( m_size - m_position < sizeof(record) ) {
+				return false;
+			}
+			std::memcpy(&record, m_data + m_position, sizeof(record));
+			size_t floats = 2 * (record.numVoices + record.outputChannels);
+			if( record.numVoices > maxEngineVoices || record.outputChannels > maxChordNotes
+				|| m_size - m_position - sizeof(record) < floats * sizeof(float) ) {
+				return false;
+			}
+			const char *values = m_data + m_position + sizeof(record);
+			m_position += sizeof(record) + floats * sizeof(float);
+
+			skippedSamples = record.skippedSamples;
+			frame.sampleTime = record.sampleTime;
+			std::copy(record.params, record.params + traceParams, frame.params);
+			frame.numVoices = record.numVoices;
+			frame.outputChannels = record.outputChannels;
+			size_t voiceBytes = record.numVoices * sizeof(float);
+			size_t channelBytes = record.outputChannels * sizeof(float);
+			std::memcpy(frame.voct, values, voiceBytes);
+			std::memcpy(frame.gate, values + voiceBytes, voiceBytes);
+			std::memcpy(frame.pitchOutputs, values + 2 * voiceBytes, channelBytes);
+			std::memcpy(frame.gateOutputs, values + 2 * voiceBytes + channelBytes, channelBytes);
+			return true;
+		}
+};
+
+// The engine, driven the way the module's process() drives it
+class Replay
+{
+	private:
+		std::unique_ptr<Scale> m_ownedScale;
+		const Scale *m_scale = NULL;
+		std::unique_ptr<ChordEngine> m_engine;
+		float m_voct[maxEngineVoices] = {};
+		float m_gate[maxEngineVoices] = {};
+	public:
+		bool Start(const std::string &scaleSpec, std::string &error)
+		{
+			m_scale = scaleFromSpec(scaleSpec, m_ownedScale, error);
+			m_engine.reset(new ChordEngine(true));
+			return m_scale != NULL;
+		}
+		// Runs the frame's inputs and knobs through the engine
+		const ChordEngine &Process(const TraceFrame &frame)
+		{
+			ChordEngineSettings settings = ChordEngineSettings::FromParams(m_scale, frame.params);
+			int numVoices = std::max(frame.numVoices, 1);
+			std::copy(frame.voct, frame.voct + numVoices, m_voct);
+			std::copy(frame.gate, frame.gate + numVoices, m_gate);
+			m_engine->Process(settings, m_voct, m_gate, numVoices, frame.sampleTime);
+			return *m_engine;
+		}
+};
+
+static int fail(const std::string &message)
+{
+	fprintf(stderr, "ChordReplay: %s\n", message.c_str());
+	return 1;
+}
+
+static int compare(const char *path, float tolerance)
+{
+	MappedTrace trace;
+	Replay replay;
+	std::string error;
+	if( !trace.Open(path, error) || !replay.Start(trace.ScaleSpec(), error) ) {
+		return fail(error);
+	}
+	TraceFrame frame;
+	uint32_t skipped;
+	unsigned long long sample = 0;
+	unsigned long long mismatchedSamples = 0;
+	float worstError = 0.f;
+	const unsigned long long maxReported = 10;
+	while( trace.Next(frame, skipped) ) {
+		if( skipped ) {
+			printf("Warning: %u samples missing from the trace before sample %llu, so the rest may not match\n", skipped, sample);
+			sample += skipped;
+		}
+		const ChordEngine &engine = replay.Process(frame);
+		bool mismatch = engine.outputChannels != frame.outputChannels;
+		for( int channel = 0; channel < frame.outputChannels && !mismatch; channel++ ) {
+			float pitchError = std::fabs(engine.pitchOutputs[channel] - frame.pitchOutputs[channel]);
+			float gateError = std::fabs(engine.gateOutputs[channel] - frame.gateOutputs[channel]);
+			worstError = std::max(worstError, std::max(pitchError, gateError));
+			if( !(pitchError <= tolerance && gateError <= tolerance) ) {
+				mismatch = true;
+				if( mismatchedSamples < maxReported ) {
+					printf("Sample %llu channel %d: pitch %.9g gate %g, expected pitch %.9g gate %g\n", sample, channel,
+						engine.pitchOutputs[channel], engine.gateOutputs[channel], frame.pitchOutputs[channel], frame.gateOutputs[channel]);
+				}
+			}
+		}
+		if( engine.outputChannels != frame.outputChannels && mismatchedSamples < maxReported ) {
+			printf("Sample %llu: %d channels, expected %d\n", sample, engine.outputChannels, frame.outputChannels);
+		}
+		mismatchedSamples += mismatch;
+		sample++;
+	}
+	printf("%llu samples compared, %llu mismatched (worst error %g V, tolerance %g V)\n", sample, mismatchedSamples, worstError, tolerance);
+	return mismatchedSamples ? 1 : 0;
+}
+
+static int golden(const char *path, const char *newPath)
+{
+	MappedTrace trace;
+	Replay replay;
+	std::string error;
+	if( !trace.Open(path, error) || !replay.Start(trace.ScaleSpec(), error) ) {
+		return fail(error);
+	}
+	std::FILE *file = std::fopen(newPath, "wb");
+	if( !file ) {
+		return fail(std::string("Can't write ") + newPath);
+	}
+	writeTraceHeader(file, trace.ScaleSpec());
+	TraceFrame frame;
+	uint32_t skipped;
+	unsigned long long samples = 0;
+	while( trace.Next(frame, skipped) ) {
+		const ChordEngine &engine = replay.Process(frame);
+		frame.outputChannels = engine.outputChannels;
+		std::copy(engine.pitchOutputs, engine.pitchOutputs + engine.outputChannels, frame.pitchOutputs);
+		std::copy(engine.gateOutputs, engine.gateOutputs + engine.outputChannels, frame.gateOutputs);
+		// The replay never drops samples
+		writeTraceRecord(file, frame, 0);
+		samples++;
+	}
+	std::fclose(file);
+	printf("%llu samples written to %s\n", samples, newPath);
+	return 0;
+}
+
+// Players rolling over between keys on a few voices, and occasionally turning the knobs
+static int synthesize(const char *newPath, unsigned long long samples, unsigned seed)
+{
+	const std::string scaleSpec = "builtin:0";
+	Replay replay;
+	std::string error;
+	if( !replay.Start(scaleSpec, error) ) {
+		return fail(error);
+	}
+	std::FILE *file = std::fopen(newPath, "wb");
+	if( !file ) {
+		return fail(std::string("Can't write ") + newPath);
+	}
+	writeTraceHeader(file, scaleSpec);
+	std::mt19937 random(seed);
+	std::uniform_int_distribution<int> semis(-12, 24);
+	std::uniform_int_distribution<int> voiceCounts(1, 4);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	TraceFrame frame;
+	frame.sampleTime = 1.f / 48000.f;
+	frame.numVoices = 1;
+	std::fill(frame.voct, frame.voct + maxEngineVoices, 0.f);
+	std::fill(frame.gate, frame.gate + maxEngineVoices, 0.f);
+	for( unsigned long long sample = 0; sample < samples; sample++ ) {
+		if( sample % 48000 == 0 ) {
+			frame.params[KEYSIG_ENGINE_PARAM] = (float)(int)(unit(random) * 12.f);
+			frame.params[MODE_ENGINE_PARAM] = (float)(int)(unit(random) * 7.f);
+			frame.params[CHORD_ENGINE_PARAM] = (float)(1 + (int)(unit(random) * (unit(random) < 0.8f ? 7.f : 16.f)));
+			frame.params[TIME_ENGINE_PARAM] = 0.01f + unit(random) * unit(random);
+			frame.params[PROFILE_ENGINE_PARAM] = 1.f + unit(random) * 9.f;
+			frame.params[JUMBLE_ENGINE_PARAM] = unit(random) < 0.3f ? 0.f : unit(random);
+			frame.params[CURVE_ENGINE_PARAM] = (float)(int)(unit(random) * NUM_GLIDE_CURVES);
+			frame.params[STRUM_ENGINE_PARAM] = (float)(int)(unit(random) * NUM_STRUM_MODES);
+			frame.params[SPREAD_ENGINE_PARAM] = unit(random);
+			frame.numVoices = voiceCounts(random);
+		}
+		for( int voice = 0; voice < frame.numVoices; voice++ ) {
+			// Each voice has a new key every 50ms or so, and lifts its gate every 250ms or so
+			if( unit(random) < 1.f / 2400.f ) {
+				frame.voct[voice] = semis(random) / 12.f;
+			}
+			if( unit(random) < 1.f / 12000.f ) {
+				frame.gate[voice] = frame.gate[voice] > 0.f ? 0.f : 10.f;
+			}
+		}
+		const ChordEngine &engine = replay.Process(frame);
+		frame.outputChannels = engine.outputChannels;
+		std::copy(engine.pitchOutputs, engine.pitchOutputs + engine.outputChannels, frame.pitchOutputs);
+		std::copy(engine.gateOutputs, engine.gateOutputs + engine.outputChannels, frame.gateOutputs);
+		writeTraceRecord(file, frame, 0);
+	}
+	std::fclose(file);
+	printf("%llu samples written to %s\n", samples, newPath);
+	return 0;
+}
+
+static int throughput(const char *path, int repeats)
+{
+	MappedTrace trace;
+	std::string error;
+	if( !trace.Open(path, error) ) {
+		return fail(error);
+	}
+	unsigned long long samples = 0;
+	double audioSeconds = 0.0;
+	double seconds = 0.0;
+	float sink = 0.f;
+	for( int repeat = 0; repeat < repeats; repeat++ ) {
+		// A fresh engine each time round, so that every repeat does the same work
+		Replay replay;
+		if( !replay.Start(trace.ScaleSpec(), error) ) {
+			return fail(error);
+		}
+		trace.Rewind();
+		TraceFrame frame;
+		uint32_t skipped;
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		while( trace.Next(frame, skipped) ) {
+			sink += replay.Process(frame).pitchOutputs[0];
+			samples++;
+			audioSeconds += frame.sampleTime;
+		}
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	printf("{\"samples\": %llu, \"seconds\": %.3f, \"samples_per_second\": %.0f, \"realtime_factor\": %.1f, \"sink\": %g}\n",
+		samples, seconds, samples / seconds, audioSeconds / seconds, sink);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	std::string mode = argc > 1 ? argv[1] : "";
+	if( mode == "compare" && argc >= 3 ) {
+		return compare(argv[2], argc > 3 ? (float)atof(argv[3]) : 0.f);
+	}
+	if( mode == "golden" && argc >= 4 ) {
+		return golden(argv[2], argv[3]);
+	}
+	if( mode == "synthesize" && argc >= 4 ) {
+		return synthesize(argv[2], strtoull(argv[3], NULL, 10), argc > 4 ? (unsigned)strtoul(argv[4], NULL, 10) : 1);
+	}
+	if( mode == "throughput" && argc >= 3 ) {
+		return throughput(argv[2], argc > 3 ? std::max(atoi(argv[3]), 1) : 1);
+	}
+	fprintf(stderr,
+		"Usage: ChordReplay compare <trace> [tolerance]\n"
+		"       ChordReplay golden <trace> <new trace>\n"
+		"       ChordReplay synthesize <new trace> <samples> [seed]\n"
+		"       ChordReplay throughput <trace> [repeats]\n");
+	return 2;
+}